@@ -0,0 +1,251 @@
+#include <stdlib.h>
+#include <string.h>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+#include "allocator.h"
+
+#define ALIGNMENT 16
+#define ALIGN(size) (((size) + ALIGNMENT - 1) & ~(size_t)(ALIGNMENT - 1))
+
+static void *defaultAllocate(void *state, size_t size) {
+  (void)state;
+  return malloc(size);
+}
+
+static void *defaultResize(void *state, void *pointer, size_t oldSize,
+                           size_t newSize) {
+  (void)state;
+  (void)oldSize;
+  return realloc(pointer, newSize);
+}
+
+static void defaultFree(void *state, void *pointer, size_t size) {
+  (void)state;
+  (void)size;
+  free(pointer);
+}
+
+static void defaultTrim(void *state) {
+  (void)state;
+#ifdef __GLIBC__
+  // Also releases free pages in the middle of the heap, not just at the top.
+  malloc_trim(0);
+#endif
+}
+
+Allocator defaultAllocator() {
+  return (Allocator){defaultAllocate, defaultResize, defaultFree, NULL,
+                     defaultTrim, NULL};
+}
+
+struct ArenaBlock {
+  ArenaBlock *next;
+  size_t capacity;
+  size_t used;
+};
+
+#define BLOCK_HEADER ALIGN(sizeof(ArenaBlock))
+
+static char *blockData(ArenaBlock *block) { return (char *)block + BLOCK_HEADER; }
+
+void initArena(Arena *arena, size_t blockSize) {
+  arena->blocks = NULL;
+  arena->blockSize = ALIGN(blockSize);
+}
+
+void freeArena(Arena *arena) {
+  ArenaBlock *block = arena->blocks;
+  while (block != NULL) {
+    ArenaBlock *next = block->next;
+    free(block);
+    block = next;
+  }
+  arena->blocks = NULL;
+}
+
+static ArenaBlock *newBlock(Arena *arena, size_t size) {
+  size_t capacity = size > arena->blockSize ? size : arena->blockSize;
+  ArenaBlock *block = (ArenaBlock *)malloc(BLOCK_HEADER + capacity);
+  if (block == NULL)
+    return NULL;
+  block->capacity = capacity;
+  block->used = 0;
+
+  // An oversized block is filled by this one allocation, so it goes behind
+  // the current block rather than replacing it.
+  if (size > arena->blockSize && arena->blocks != NULL) {
+    block->next = arena->blocks->next;
+    arena->blocks->next = block;
+  } else {
+    block->next = arena->blocks;
+    arena->blocks = block;
+  }
+  return block;
+}
+
+// Only the latest allocation in the current block can shrink, grow or be
+// given back.
+static bool isLatest(Arena *arena, void *pointer, size_t size) {
+  ArenaBlock *block = arena->blocks;
+  return block != NULL &&
+         (char *)pointer + ALIGN(size) == blockData(block) + block->used;
+}
+
+static void *arenaAllocate(void *state, size_t size) {
+  Arena *arena = (Arena *)state;
+  size = ALIGN(size);
+  ArenaBlock *block = arena->blocks;
+  if (block == NULL || block->capacity - block->used < size) {
+    block = newBlock(arena, size);
+    if (block == NULL)
+      return NULL;
+  }
+
+  void *result = blockData(block) + block->used;
+  block->used += size;
+  return result;
+}
+
+static void *arenaResize(void *state, void *pointer, size_t oldSize,
+                         size_t newSize) {
+  Arena *arena = (Arena *)state;
+  if (isLatest(arena, pointer, oldSize)) {
+    ArenaBlock *block = arena->blocks;
+    size_t start = block->used - ALIGN(oldSize);
+    if (block->capacity - start >= ALIGN(newSize)) {
+      block->used = start + ALIGN(newSize);
+      return pointer;
+    }
+  }
+
+  void *result = arenaAllocate(state, newSize);
+  if (result == NULL)
+    return NULL;
+  memcpy(result, pointer, oldSize < newSize ? oldSize : newSize);
+  return result;
+}
+
+static void arenaFree(void *state, void *pointer, size_t size) {
+  Arena *arena = (Arena *)state;
+  if (pointer != NULL && isLatest(arena, pointer, size)) {
+    arena->blocks->used -= ALIGN(size);
+  }
+}
+
+static void arenaReset(void *state) {
+  // Keep one regular block so the next VM on this arena starts warm.
+  Arena *arena = (Arena *)state;
+  ArenaBlock *kept = NULL;
+  ArenaBlock *block = arena->blocks;
+  while (block != NULL) {
+    ArenaBlock *next = block->next;
+    if (kept == NULL && block->capacity == arena->blockSize) {
+      kept = block;
+      kept->used = 0;
+      kept->next = NULL;
+    } else {
+      free(block);
+    }
+    block = next;
+  }
+  arena->blocks = kept;
+}
+
+Allocator arenaAllocator(Arena *arena) {
+  return (Allocator){arenaAllocate, arenaResize, arenaFree, arenaReset, NULL,
+                     arena};
+}
+
+struct PoolSlab {
+  PoolSlab *next;
+};
+
+#define POOL_GRANULE 16
+#define POOL_MAX_SIZE (POOL_CLASS_COUNT * POOL_GRANULE)
+#define POOL_SLAB_SIZE (64 * 1024)
+
+static int sizeClass(size_t size) { return (int)((size - 1) / POOL_GRANULE); }
+
+void initPool(Pool *pool) {
+  for (int i = 0; i < POOL_CLASS_COUNT; i++) {
+    pool->freeLists[i] = NULL;
+  }
+  pool->slabs = NULL;
+}
+
+void freePool(Pool *pool) {
+  PoolSlab *slab = pool->slabs;
+  while (slab != NULL) {
+    PoolSlab *next = slab->next;
+    free(slab);
+    slab = next;
+  }
+  initPool(pool);
+}
+
+// Carves a fresh slab into cells of one size class.
+static bool refill(Pool *pool, int index) {
+  PoolSlab *slab = (PoolSlab *)malloc(POOL_SLAB_SIZE);
+  if (slab == NULL)
+    return false;
+  slab->next = pool->slabs;
+  pool->slabs = slab;
+
+  size_t cellSize = (size_t)(index + 1) * POOL_GRANULE;
+  char *end = (char *)slab + POOL_SLAB_SIZE;
+  for (char *cell = (char *)slab + ALIGN(sizeof(PoolSlab));
+       cell + cellSize <= end; cell += cellSize) {
+    *(void **)cell = pool->freeLists[index];
+    pool->freeLists[index] = cell;
+  }
+  return true;
+}
+
+static void *poolAllocate(void *state, size_t size) {
+  Pool *pool = (Pool *)state;
+  if (size > POOL_MAX_SIZE)
+    return malloc(size);
+
+  int index = sizeClass(size);
+  if (pool->freeLists[index] == NULL && !refill(pool, index))
+    return NULL;
+  void *cell = pool->freeLists[index];
+  pool->freeLists[index] = *(void **)cell;
+  return cell;
+}
+
+static void poolFree(void *state, void *pointer, size_t size) {
+  Pool *pool = (Pool *)state;
+  if (pointer == NULL)
+    return;
+  if (size > POOL_MAX_SIZE) {
+    free(pointer);
+    return;
+  }
+
+  int index = sizeClass(size);
+  *(void **)pointer = pool->freeLists[index];
+  pool->freeLists[index] = pointer;
+}
+
+static void *poolResize(void *state, void *pointer, size_t oldSize,
+                        size_t newSize) {
+  if (oldSize > POOL_MAX_SIZE && newSize > POOL_MAX_SIZE)
+    return realloc(pointer, newSize);
+  if (oldSize <= POOL_MAX_SIZE && newSize <= POOL_MAX_SIZE &&
+      sizeClass(oldSize) == sizeClass(newSize))
+    return pointer;
+
+  void *result = poolAllocate(state, newSize);
+  if (result == NULL)
+    return NULL;
+  memcpy(result, pointer, oldSize < newSize ? oldSize : newSize);
+  poolFree(state, pointer, oldSize);
+  return result;
+}
+
+Allocator poolAllocator(Pool *pool) {
+  return (Allocator){poolAllocate, poolResize, poolFree, NULL, NULL, pool};
+}
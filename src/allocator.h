@@ -0,0 +1,53 @@
+#ifndef clang_allocator_h
+#define clang_allocator_h
+
+#include "common.h"
+
+// Where the VM gets its memory. Every allocation goes through reallocate(),
+// which always passes the size a block was allocated with, so backends don't
+// need to record it themselves. Allocation failures return NULL.
+typedef struct {
+  void *(*allocate)(void *state, size_t size);
+  void *(*resize)(void *state, void *pointer, size_t oldSize, size_t newSize);
+  void (*free)(void *state, void *pointer, size_t size);
+  // Optional. Releases every block at once; freeVM calls it instead of
+  // freeing objects one by one.
+  void (*reset)(void *state);
+  // Optional. Hands free memory back to the OS; called after collections
+  // that freed a lot.
+  void (*trim)(void *state);
+  void *state;
+} Allocator;
+
+// Plain malloc/realloc/free.
+Allocator defaultAllocator();
+
+// Bump allocation out of large blocks. Frees only reclaim the most recent
+// allocation, so it suits short-lived VMs that are torn down wholesale.
+typedef struct ArenaBlock ArenaBlock;
+
+typedef struct {
+  ArenaBlock *blocks;
+  size_t blockSize;
+} Arena;
+
+void initArena(Arena *arena, size_t blockSize);
+void freeArena(Arena *arena);
+Allocator arenaAllocator(Arena *arena);
+
+// Free lists for small blocks in 16-byte size classes, carved from slabs.
+// Larger blocks go straight to malloc.
+#define POOL_CLASS_COUNT 16
+
+typedef struct PoolSlab PoolSlab;
+
+typedef struct {
+  void *freeLists[POOL_CLASS_COUNT];
+  PoolSlab *slabs;
+} Pool;
+
+void initPool(Pool *pool);
+void freePool(Pool *pool);
+Allocator poolAllocator(Pool *pool);
+
+#endif // clang_allocator_h
@@ -1,5 +1,6 @@
 #include "chunk.h"
 #include "memory.h"
+#include "object.h"
 #include "value.h"
 #include "vm.h"
 #include <stdint.h>
@@ -12,12 +13,20 @@ void initChunk(Chunk *chunk) {
   chunk->lineCount = 0;
   chunk->lineCapacity = 0;
   chunk->lines = NULL;
+  chunk->handlerCount = 0;
+  chunk->handlerCapacity = 0;
+  chunk->handlers = NULL;
+  chunk->localInfoCount = 0;
+  chunk->localInfoCapacity = 0;
+  chunk->localInfos = NULL;
   initValueArray(&chunk->constants);
 }
 
 void freeChunk(Chunk *chunk) {
   FREE_ARRAY(uint8_t, chunk->code, chunk->capacity);
-  FREE_ARRAY(LineStart, chunk->lines, chunk->capacity);
+  FREE_ARRAY(LineStart, chunk->lines, chunk->lineCapacity);
+  FREE_ARRAY(ExceptionHandler, chunk->handlers, chunk->handlerCapacity);
+  FREE_ARRAY(LocalInfo, chunk->localInfos, chunk->localInfoCapacity);
   freeValueArray(&chunk->constants);
   initChunk(chunk);
 }
@@ -71,6 +80,60 @@ void writeConstant(Chunk *chunk, Value value, int line) {
   }
 }
 
+void addHandler(Chunk *chunk, int start, int end, int handler, int stackDepth) {
+  if (chunk->handlerCapacity < chunk->handlerCount + 1) {
+    int oldCapacity = chunk->handlerCapacity;
+    chunk->handlerCapacity = GROW_CAPACITY(oldCapacity);
+    chunk->handlers = GROW_ARRAY(ExceptionHandler, chunk->handlers,
+                                 oldCapacity, chunk->handlerCapacity);
+  }
+
+  ExceptionHandler *entry = &chunk->handlers[chunk->handlerCount++];
+  entry->start = start;
+  entry->end = end;
+  entry->handler = handler;
+  entry->stackDepth = stackDepth;
+}
+
+int addLocalInfo(Chunk *chunk, ObjString *name, int slot, int start) {
+  push(OBJ_VAL(name));
+  if (chunk->localInfoCapacity < chunk->localInfoCount + 1) {
+    int oldCapacity = chunk->localInfoCapacity;
+    chunk->localInfoCapacity = GROW_CAPACITY(oldCapacity);
+    chunk->localInfos = GROW_ARRAY(LocalInfo, chunk->localInfos, oldCapacity,
+                                   chunk->localInfoCapacity);
+  }
+  pop();
+
+  LocalInfo *info = &chunk->localInfos[chunk->localInfoCount];
+  info->name = name;
+  info->slot = slot;
+  info->start = start;
+  info->end = chunk->count;
+  return chunk->localInfoCount++;
+}
+
+void truncateChunk(Chunk *chunk, int count) {
+  // Drops the code from offset count onwards, e.g. when folding constants.
+  chunk->count = count;
+  while (chunk->lineCount > 0 &&
+         chunk->lines[chunk->lineCount - 1].offset >= count) {
+    chunk->lineCount--;
+  }
+}
+
+void clearLoopGuard(Chunk *chunk, int offset) {
+  // A loop guard is the list load followed by OP_GUARD_LIST, five bytes in
+  // all. Without one, the space becomes a jump over two never-run filler
+  // instructions so that the code still decodes.
+  uint8_t *code = &chunk->code[offset];
+  code[0] = OP_JUMP;
+  code[1] = 0;
+  code[2] = 2;
+  code[3] = OP_NIL;
+  code[4] = OP_POP;
+}
+
 int getLine(Chunk *chunk, int instruction) {
   int start = 0;
   int end = chunk->lineCount - 1;
@@ -88,3 +151,76 @@ int getLine(Chunk *chunk, int instruction) {
     }
   }
 }
+
+StaticType staticTypeOf(Value value) {
+  if (IS_NUMBER(value))
+    return STATIC_NUMBER;
+  if (IS_BOOL(value))
+    return STATIC_BOOL;
+  if (IS_STRING(value))
+    return STATIC_STRING;
+  return STATIC_ANY;
+}
+
+const char *staticTypeName(StaticType type) {
+  switch (type) {
+  case STATIC_NUMBER:
+    return "num";
+  case STATIC_STRING:
+    return "str";
+  case STATIC_BOOL:
+    return "bool";
+  default:
+    return "any";
+  }
+}
+
+int instructionLength(Chunk *chunk, int offset) {
+  switch (chunk->code[offset]) {
+  case OP_CONSTANT_LONG:
+    return 4;
+  case OP_CONSTANT:
+  case OP_GET_LOCAL:
+  case OP_SET_LOCAL:
+  case OP_GET_GLOBAL:
+  case OP_DEFINE_GLOBAL:
+  case OP_SET_GLOBAL:
+  case OP_GET_UPVALUE:
+  case OP_SET_UPVALUE:
+  case OP_COMPOUND_SUBSCR:
+  case OP_GET_PROPERTY:
+  case OP_SET_PROPERTY:
+  case OP_GET_SUPER:
+  case OP_CHECK_TYPE:
+  case OP_CALL:
+  case OP_BUILD_LIST:
+  case OP_BUILD_TUPLE:
+  case OP_RETURN:
+  case OP_UNPACK:
+  case OP_CLASS:
+  case OP_METHOD:
+    return 2;
+  case OP_COMPOUND_LOCAL:
+  case OP_COMPOUND_GLOBAL:
+  case OP_COMPOUND_UPVALUE:
+  case OP_COMPOUND_PROPERTY:
+  case OP_GET_FIELD:
+  case OP_SET_FIELD:
+  case OP_UPDATE_FIELD:
+  case OP_JUMP:
+  case OP_JUMP_IF_FALSE:
+  case OP_LOOP:
+  case OP_GUARD_LIST:
+  case OP_INVOKE:
+  case OP_SUPER_INVOKE:
+    return 3;
+  case OP_STRUCT:
+    return 3 + chunk->code[offset + 2];
+  case OP_CLOSURE: {
+    Value function = chunk->constants.values[chunk->code[offset + 1]];
+    return 2 + 2 * AS_FUNCTION(function)->upvalueCount;
+  }
+  default:
+    return 1;
+  }
+}
@@ -4,6 +4,21 @@
 #include "common.h"
 #include "value.h"
 
+// Operand flag for the OP_COMPOUND_* instructions, or'd onto the arithmetic
+// opcode: leave the target's old value on the stack (postfix ++ and --).
+#define COMPOUND_POSTFIX 0x80
+// Operand flag for OP_COMPOUND_PROPERTY: also leave the receiver on the
+// stack, above the value, for the compiler to store back into its variable.
+#define COMPOUND_UPDATE 0x40
+
+// Types a value can be annotated with. OP_CHECK_TYPE takes one as its operand.
+typedef enum {
+  STATIC_ANY,
+  STATIC_NUMBER,
+  STATIC_STRING,
+  STATIC_BOOL,
+} StaticType;
+
 typedef enum {
   OP_CONSTANT,
   OP_CONSTANT_LONG,
@@ -19,17 +34,35 @@ typedef enum {
   OP_SET_GLOBAL,
   OP_GET_UPVALUE,
   OP_SET_UPVALUE,
+  OP_COMPOUND_LOCAL,
+  OP_COMPOUND_GLOBAL,
+  OP_COMPOUND_UPVALUE,
+  OP_COMPOUND_PROPERTY,
+  OP_COMPOUND_SUBSCR,
   OP_GET_PROPERTY,
   OP_SET_PROPERTY,
+  OP_GET_FIELD,
+  OP_SET_FIELD,
+  OP_UPDATE_FIELD,
+  OP_GET_SUPER,
   OP_EQUAL,
   OP_GREATER,
   OP_LESS,
+  OP_IN,
   OP_ADD,
   OP_SUBTRACT,
   OP_MULTIPLY,
   OP_DIVIDE,
   OP_NOT,
   OP_NEGATE,
+  OP_ADD_NUM,
+  OP_SUBTRACT_NUM,
+  OP_MULTIPLY_NUM,
+  OP_DIVIDE_NUM,
+  OP_GREATER_NUM,
+  OP_LESS_NUM,
+  OP_NEGATE_NUM,
+  OP_CHECK_TYPE,
   OP_PRINT,
   OP_JUMP,
   OP_JUMP_IF_FALSE,
@@ -37,14 +70,23 @@ typedef enum {
   OP_LOOP,
   OP_CALL,
   OP_INVOKE,
+  OP_SUPER_INVOKE,
   OP_CLOSURE,
   OP_BUILD_LIST,
+  OP_BUILD_TUPLE,
   OP_INDEX_SUBSCR,
   OP_STORE_SUBSCR,
+  OP_INDEX_LIST,
+  OP_STORE_LIST,
+  OP_GUARD_LIST,
   OP_CLOSE_UPVALUE,
   OP_RETURN,
+  OP_UNPACK,
+  OP_THROW,
   OP_CLASS,
-  OP_METHOD
+  OP_INHERIT,
+  OP_METHOD,
+  OP_STRUCT
 } OpCode;
 
 typedef struct {
@@ -52,6 +94,24 @@ typedef struct {
   int line;
 } LineStart;
 
+// A try block: an exception raised by an instruction in [start, end) jumps
+// to handler with the frame's stack cut back to stackDepth slots.
+typedef struct {
+  int start;
+  int end;
+  int handler;
+  int stackDepth;
+} ExceptionHandler;
+
+// Debug info for the debugger: the local named name lives in slot while
+// the instructions in [start, end) run.
+typedef struct {
+  ObjString *name;
+  int slot;
+  int start;
+  int end;
+} LocalInfo;
+
 typedef struct {
   int count;
   int capacity;
@@ -60,6 +120,12 @@ typedef struct {
   int lineCount;
   int lineCapacity;
   LineStart *lines;
+  int handlerCount;
+  int handlerCapacity;
+  ExceptionHandler *handlers;
+  int localInfoCount;
+  int localInfoCapacity;
+  LocalInfo *localInfos;
 } Chunk;
 
 void initChunk(Chunk *chunk);
@@ -68,5 +134,12 @@ void writeChunk(Chunk *chunk, uint8_t byte, int line);
 int addConstant(Chunk *chunk, Value value);
 void writeConstant(Chunk *chunk, Value value, int line);
 int getLine(Chunk *chunk, int instruction);
+void truncateChunk(Chunk *chunk, int count);
+void addHandler(Chunk *chunk, int start, int end, int handler, int stackDepth);
+int addLocalInfo(Chunk *chunk, ObjString *name, int slot, int start);
+int instructionLength(Chunk *chunk, int offset);
+void clearLoopGuard(Chunk *chunk, int offset);
+StaticType staticTypeOf(Value value);
+const char *staticTypeName(StaticType type);
 
 #endif // clang_chunk_h
@@ -8,6 +8,7 @@
 #define DEBUG_PRINT_CODE
 // #define DEBUG_TRACE_EXECUTION
 // #define DEBUG_STRESS_GC
+// #define DEBUG_VERIFY_TYPES
 #define DEBUG_LOG_GC
 
 #define UINT8_COUNT (UINT8_MAX + 1)
@@ -1,9 +1,12 @@
 #include "compiler.h"
 #include "chunk.h"
 #include "common.h"
+#include "debugger.h"
+#include "infer.h"
 #include "memory.h"
 #include "object.h"
 #include "scanner.h"
+#include "vm.h"
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -19,6 +22,19 @@ typedef struct {
   Token previous;
   bool hadError;
   bool panicMode;
+  // What the compiler can prove about the value the last expression left on
+  // the stack, and about the left operand while an infix rule runs.
+  StaticType exprType;
+  StaticType leftType;
+  // Where the left operand's code starts, so binary() can fold constants.
+  int leftStart;
+  // Where the last plain read of an assignable variable ends, and how to
+  // store to it, so dot() can store an updated struct back. The set op is
+  // OP_POP for 'this', which needs no storing back.
+  int variableEnd;
+  uint8_t variableGetOp;
+  uint8_t variableSetOp;
+  uint8_t variableArg;
 } Parser;
 
 typedef enum {
@@ -48,11 +64,16 @@ typedef struct {
   Token name;
   int depth;
   bool isCaptured;
+  bool isConst;
+  StaticType type;
+  int infoIndex; // Into the chunk's localInfos, or -1.
 } Local;
 
 typedef struct {
   uint8_t index;
   bool isLocal;
+  bool isConst;
+  StaticType type;
 } Upvalue;
 
 typedef enum {
@@ -62,6 +83,21 @@ typedef enum {
   TYPE_SCRIPT,
 } FunctionType;
 
+#define LIST_LOOP_SITES 32
+
+// A for loop of the form `for (let i = n; i < xs.len(); i += step)`. While
+// nothing in its body can resize xs or change either variable, xs[i] in the
+// body skips its checks behind one guard at loop entry.
+typedef struct ListLoop {
+  struct ListLoop *enclosing;
+  bool eligible;
+  uint8_t listOp; // How xs is read: OP_GET_LOCAL, _UPVALUE or _GLOBAL.
+  uint8_t listArg;
+  uint8_t indexSlot;
+  int siteCount;
+  int sites[LIST_LOOP_SITES]; // Offsets of the unchecked subscripts.
+} ListLoop;
+
 typedef struct Compiler {
   struct Compiler *enclosing;
   ObjFunction *function;
@@ -70,10 +106,13 @@ typedef struct Compiler {
   int localCount;
   Upvalue upvalues[UINT8_COUNT];
   int scopeDepth;
+  StaticType returnType;
+  ListLoop *listLoop;
 } Compiler;
 
 typedef struct ClassCompiler {
   struct ClassCompiler *enclosing;
+  bool hasSuperclass;
 } ClassCompiler;
 
 Parser parser;
@@ -81,8 +120,20 @@ Compiler *current = NULL;
 ClassCompiler *currentClass = NULL;
 Chunk *compilingChunk;
 
+// Field name -> slot offset for every struct declared so far, or -1 when two
+// structs put the same name at different offsets.
+Table fieldOffsets;
+// Top-level `const` names, mapped to their value when it is known at compile
+// time and to nil when it's only known at runtime. Starts from the VM's and
+// is only kept if the compile succeeds.
+Table constGlobals;
+// Top-level `let` names declared with a type, mapped to it, so assignments
+// compiled after the declaration are checked. Kept like constGlobals.
+Table globalTypes;
+
 static void statement();
 static void declaration();
+static void block();
 
 static Chunk *currentChunk() { return &current->function->chunk; }
 
@@ -167,16 +218,109 @@ static int emitJump(uint8_t instruction) {
   return currentChunk()->count - 2;
 }
 
+static void disqualifyListLoop(ListLoop *loop) {
+  // Puts the checks back on the subscripts already emitted in the loop.
+  Chunk *chunk = currentChunk();
+  for (int i = 0; i < loop->siteCount; i++) {
+    uint8_t *code = &chunk->code[loop->sites[i]];
+    *code = *code == OP_INDEX_LIST ? OP_INDEX_SUBSCR : OP_STORE_SUBSCR;
+  }
+  loop->siteCount = 0;
+  loop->eligible = false;
+}
+
+static void noteCall() {
+  // A call can run code that resizes any list.
+  for (ListLoop *loop = current->listLoop; loop != NULL;
+       loop = loop->enclosing) {
+    if (loop->eligible)
+      disqualifyListLoop(loop);
+  }
+}
+
+static void noteWrite(uint8_t getOp, uint8_t arg) {
+  for (ListLoop *loop = current->listLoop; loop != NULL;
+       loop = loop->enclosing) {
+    if (loop->eligible &&
+        ((getOp == loop->listOp && arg == loop->listArg) ||
+         (getOp == OP_GET_LOCAL && arg == loop->indexSlot))) {
+      disqualifyListLoop(loop);
+    }
+  }
+}
+
+static ListLoop *boundingLoop(int listStart, int indexStart) {
+  // Finds the loop, if any, whose list and index variables are exactly the
+  // operands of the subscript being compiled.
+  Chunk *chunk = currentChunk();
+  if (listStart + 2 != indexStart || chunk->count != indexStart + 2 ||
+      chunk->code[indexStart] != OP_GET_LOCAL) {
+    return NULL;
+  }
+  for (ListLoop *loop = current->listLoop; loop != NULL;
+       loop = loop->enclosing) {
+    if (loop->eligible && chunk->code[listStart] == loop->listOp &&
+        chunk->code[listStart + 1] == loop->listArg &&
+        chunk->code[indexStart + 1] == loop->indexSlot) {
+      return loop;
+    }
+  }
+  return NULL;
+}
+
+static void emitSubscript(ListLoop *loop, OpCode checked, OpCode unchecked) {
+  // The loop may have lost its eligibility while the right-hand side of a
+  // store was compiled.
+  if (loop != NULL && loop->eligible && loop->siteCount < LIST_LOOP_SITES) {
+    loop->sites[loop->siteCount++] = currentChunk()->count;
+    emitByte(unchecked);
+  } else {
+    emitByte(checked);
+  }
+}
+
+static void emitTypeCheck(StaticType type) {
+  // Guard a value entering a typed variable, parameter or return, unless the
+  // compiler already knows it has that type.
+  if (type != STATIC_ANY && parser.exprType != type) {
+    emitBytes(OP_CHECK_TYPE, (uint8_t)type);
+  }
+}
+
 static void emitReturn() {
   if (current->type == TYPE_INITIALIZER) {
     emitBytes(OP_GET_LOCAL, 0);
   } else {
     emitByte(OP_NIL);
+    parser.exprType = STATIC_ANY;
+    emitTypeCheck(current->returnType);
+  }
+  emitBytes(OP_RETURN, 1);
+}
+
+static bool sameConstant(Value a, Value b) {
+  if (a.type != b.type)
+    return false;
+  if (IS_NUMBER(a)) {
+    // Compare bits so that 0 and -0 stay distinct.
+    double x = AS_NUMBER(a);
+    double y = AS_NUMBER(b);
+    return memcmp(&x, &y, sizeof(double)) == 0;
   }
-  emitByte(OP_RETURN);
+  return IS_STRING(a) && AS_OBJ(a) == AS_OBJ(b);
 }
 
 static uint8_t makeConstant(Value value) {
+  // Reuse an identical number or string, so inlined constants and repeated
+  // names don't fill up the pool.
+  ValueArray *constants = &currentChunk()->constants;
+  if (IS_NUMBER(value) || IS_STRING(value)) {
+    for (int i = 0; i < constants->count && i <= UINT8_MAX; i++) {
+      if (sameConstant(constants->values[i], value))
+        return (uint8_t)i;
+    }
+  }
+
   int constant = addConstant(currentChunk(), value);
   if (constant > UINT8_MAX) {
     error("Too many constants in one chunk");
@@ -190,6 +334,42 @@ static void emitConstant(Value value) {
   emitBytes(OP_CONSTANT, makeConstant(value));
 }
 
+static void emitValue(Value value) {
+  if (IS_NIL(value)) {
+    emitByte(OP_NIL);
+  } else if (IS_BOOL(value)) {
+    emitByte(AS_BOOL(value) ? OP_TRUE : OP_FALSE);
+  } else {
+    emitConstant(value);
+  }
+  parser.exprType = staticTypeOf(value);
+}
+
+static bool emittedConstant(int start, int end, Value *value) {
+  // Reports whether the code in [start, end) just loads a single constant.
+  Chunk *chunk = currentChunk();
+  if (end - start == 2 && chunk->code[start] == OP_CONSTANT) {
+    *value = chunk->constants.values[chunk->code[start + 1]];
+    return true;
+  }
+  if (end - start != 1)
+    return false;
+
+  switch (chunk->code[start]) {
+  case OP_NIL:
+    *value = NIL_VAL;
+    return true;
+  case OP_TRUE:
+    *value = BOOL_VAL(true);
+    return true;
+  case OP_FALSE:
+    *value = BOOL_VAL(false);
+    return true;
+  default:
+    return false;
+  }
+}
+
 static void patchJump(int offset) {
   // -2 to adjust for the bytecode for the jump offset itself
   int jump = currentChunk()->count - offset - 2;
@@ -208,8 +388,11 @@ static void initCompiler(Compiler *compiler, FunctionType type) {
   compiler->type = type;
   compiler->localCount = 0;
   compiler->scopeDepth = 0;
+  compiler->returnType = STATIC_ANY;
+  compiler->listLoop = NULL;
   compiler->function = newFunction();
   current = compiler;
+  parser.variableEnd = -1;
 
   if (type != TYPE_SCRIPT) {
     current->function->name =
@@ -219,6 +402,9 @@ static void initCompiler(Compiler *compiler, FunctionType type) {
   Local *local = &current->locals[current->localCount++];
   local->depth = 0;
   local->isCaptured = false;
+  local->isConst = false;
+  local->type = STATIC_ANY;
+  local->infoIndex = -1;
 
   if (type != TYPE_FUNCTION) {
     local->name.start = "this";
@@ -229,9 +415,21 @@ static void initCompiler(Compiler *compiler, FunctionType type) {
   }
 }
 
+static void endLocalInfo(Local *local) {
+  if (local->infoIndex != -1) {
+    currentChunk()->localInfos[local->infoIndex].end = currentChunk()->count;
+  }
+}
+
 static ObjFunction *endCompiler() {
   emitReturn();
   ObjFunction *function = current->function;
+  for (int i = 0; i < current->localCount; i++) {
+    endLocalInfo(&current->locals[i]);
+  }
+  if (!parser.hadError) {
+    inferTypes(function);
+  }
 #ifdef DEBUG_PRINT_CODE
   if (!parser.hadError) {
     disassembleChunk(currentChunk(), function->name != NULL
@@ -240,6 +438,7 @@ static ObjFunction *endCompiler() {
   }
 #endif
   current = current->enclosing;
+  parser.variableEnd = -1;
   return function;
 }
 
@@ -249,6 +448,7 @@ static void endScope() {
   current->scopeDepth--;
   while (current->localCount > 0 &&
          current->locals[current->localCount - 1].depth > current->scopeDepth) {
+    endLocalInfo(&current->locals[current->localCount - 1]);
     if (current->locals[current->localCount - 1].isCaptured) {
       emitByte(OP_CLOSE_UPVALUE);
     } else {
@@ -262,11 +462,88 @@ static void expression();
 static ParseRule *getRule(TokenType type);
 static void parsePrecedence(Precedence precedence);
 
+static bool foldBinary(TokenType operatorType, Value a, Value b,
+                       Value *result) {
+  // Mirrors the VM's semantics, including >= and <= being negated < and >.
+  if (IS_NUMBER(a) && IS_NUMBER(b)) {
+    double x = AS_NUMBER(a);
+    double y = AS_NUMBER(b);
+    switch (operatorType) {
+    case TOKEN_PLUS:
+      *result = NUMBER_VAL(x + y);
+      return true;
+    case TOKEN_MINUS:
+      *result = NUMBER_VAL(x - y);
+      return true;
+    case TOKEN_STAR:
+      *result = NUMBER_VAL(x * y);
+      return true;
+    case TOKEN_SLASH:
+      *result = NUMBER_VAL(x / y);
+      return true;
+    case TOKEN_GREATER:
+      *result = BOOL_VAL(x > y);
+      return true;
+    case TOKEN_GREATER_EQUAL:
+      *result = BOOL_VAL(!(x < y));
+      return true;
+    case TOKEN_LESS:
+      *result = BOOL_VAL(x < y);
+      return true;
+    case TOKEN_LESS_EQUAL:
+      *result = BOOL_VAL(!(x > y));
+      return true;
+    default:
+      break;
+    }
+  }
+
+  switch (operatorType) {
+  case TOKEN_EQUAL_EQUAL:
+    *result = BOOL_VAL(valuesEqual(a, b));
+    return true;
+  case TOKEN_BANG_EQUAL:
+    *result = BOOL_VAL(!valuesEqual(a, b));
+    return true;
+  case TOKEN_PLUS:
+    if (IS_STRING(a) && IS_STRING(b)) {
+      ObjString *left = AS_STRING(a);
+      ObjString *right = AS_STRING(b);
+      int length = left->length + right->length;
+      char *chars = ALLOCATE(char, length + 1);
+      memcpy(chars, left->chars, left->length);
+      memcpy(chars + left->length, right->chars, right->length);
+      chars[length] = '\0';
+      *result = OBJ_VAL(takeString(chars, length));
+      return true;
+    }
+    return false;
+  default:
+    return false;
+  }
+}
+
 static void binary(bool canAssign) {
   TokenType operatorType = parser.previous.type;
+  StaticType leftType = parser.leftType;
+  int leftStart = parser.leftStart;
+  int rightStart = currentChunk()->count;
   ParseRule *rule = getRule(operatorType);
   parsePrecedence((Precedence)(rule->precedence + 1));
 
+  Value a, b, folded;
+  if (emittedConstant(leftStart, rightStart, &a) &&
+      emittedConstant(rightStart, currentChunk()->count, &b) &&
+      foldBinary(operatorType, a, b, &folded)) {
+    truncateChunk(currentChunk(), leftStart);
+    emitValue(folded);
+    return;
+  }
+
+  // When both operands are known numbers, the type guards can be skipped.
+  bool numeric = leftType == STATIC_NUMBER && parser.exprType == STATIC_NUMBER;
+  bool strings = leftType == STATIC_STRING && parser.exprType == STATIC_STRING;
+
   switch (operatorType) {
   case TOKEN_BANG_EQUAL:
     emitBytes(OP_EQUAL, OP_NOT);
@@ -275,32 +552,42 @@ static void binary(bool canAssign) {
     emitByte(OP_EQUAL);
     break;
   case TOKEN_GREATER:
-    emitByte(OP_GREATER);
+    emitByte(numeric ? OP_GREATER_NUM : OP_GREATER);
     break;
   case TOKEN_GREATER_EQUAL:
-    emitBytes(OP_LESS, OP_NOT);
+    emitBytes(numeric ? OP_LESS_NUM : OP_LESS, OP_NOT);
     break;
   case TOKEN_LESS:
-    emitByte(OP_LESS);
+    emitByte(numeric ? OP_LESS_NUM : OP_LESS);
     break;
   case TOKEN_LESS_EQUAL:
-    emitBytes(OP_GREATER, OP_NOT);
+    emitBytes(numeric ? OP_GREATER_NUM : OP_GREATER, OP_NOT);
     break;
-  case TOKEN_PLUS:
-    emitByte(OP_ADD);
+  case TOKEN_IN:
+    emitByte(OP_IN);
     break;
+  case TOKEN_PLUS:
+    emitByte(numeric ? OP_ADD_NUM : OP_ADD);
+    parser.exprType = numeric   ? STATIC_NUMBER
+                      : strings ? STATIC_STRING
+                                : STATIC_ANY;
+    return;
   case TOKEN_MINUS:
-    emitByte(OP_SUBTRACT);
-    break;
+    emitByte(numeric ? OP_SUBTRACT_NUM : OP_SUBTRACT);
+    parser.exprType = STATIC_NUMBER;
+    return;
   case TOKEN_STAR:
-    emitByte(OP_MULTIPLY);
-    break;
+    emitByte(numeric ? OP_MULTIPLY_NUM : OP_MULTIPLY);
+    parser.exprType = numeric ? STATIC_NUMBER : STATIC_ANY;
+    return;
   case TOKEN_SLASH:
-    emitByte(OP_DIVIDE);
-    break;
+    emitByte(numeric ? OP_DIVIDE_NUM : OP_DIVIDE);
+    parser.exprType = STATIC_NUMBER;
+    return;
   default:
     return; // Unreachable.
   }
+  parser.exprType = STATIC_BOOL;
 }
 
 static uint8_t argumentList() {
@@ -320,6 +607,7 @@ static uint8_t argumentList() {
 
 static void call(bool canAssign) {
   uint8_t argCount = argumentList();
+  noteCall();
   emitBytes(OP_CALL, argCount);
 }
 
@@ -327,31 +615,61 @@ static void literal(bool canAssign) {
   switch (parser.previous.type) {
   case TOKEN_FALSE:
     emitByte(OP_FALSE);
+    parser.exprType = STATIC_BOOL;
     break;
   case TOKEN_NIL:
     emitByte(OP_NIL);
     break;
   case TOKEN_TRUE:
     emitByte(OP_TRUE);
+    parser.exprType = STATIC_BOOL;
     break;
   default:
     return; // Unreachable.
   }
 }
 
+static void tuple(int itemCount) {
+  // The first item has already been compiled. A trailing comma is allowed,
+  // which is how a one-item tuple is written: (x,).
+  while (match(TOKEN_COMMA)) {
+    if (check(TOKEN_RIGHT_PAREN))
+      break;
+    expression();
+    if (itemCount == UINT8_MAX) {
+      error("Cannot have more than 255 items in a tuple literal.");
+    }
+    itemCount++;
+  }
+  consume(TOKEN_RIGHT_PAREN, "Expect ')' after tuple literal.");
+  emitBytes(OP_BUILD_TUPLE, (uint8_t)itemCount);
+  parser.exprType = STATIC_ANY;
+}
+
 static void grouping(bool canAssign) {
+  if (match(TOKEN_RIGHT_PAREN)) {
+    emitBytes(OP_BUILD_TUPLE, 0);
+    return;
+  }
+
   expression();
+  if (check(TOKEN_COMMA)) {
+    tuple(1);
+    return;
+  }
   consume(TOKEN_RIGHT_PAREN, "Expect ')' after expression");
 }
 
 static void number(bool canAssign) {
   double value = strtod(parser.previous.start, NULL);
   emitConstant(NUMBER_VAL(value));
+  parser.exprType = STATIC_NUMBER;
 }
 
 static void string(bool canAssign) {
   emitConstant(OBJ_VAL(
       copyString(parser.previous.start + 1, parser.previous.length - 2)));
+  parser.exprType = STATIC_STRING;
 }
 
 static uint8_t identifierConstant(Token *name) {
@@ -363,21 +681,167 @@ static bool identifiersEqual(Token *a, Token *b) {
     return false;
   return memcmp(a->start, b->start, a->length) == 0;
 }
+static int compoundAssignment(bool canAssign) {
+  // Compiles the operator and right-hand side of a compound assignment or a
+  // postfix increment. Returns the operand byte for the OP_COMPOUND_*
+  // instruction, or -1 if the next token doesn't start one.
+  int op;
+  switch (parser.current.type) {
+  case TOKEN_PLUS_PLUS:
+  case TOKEN_MINUS_MINUS:
+    op = check(TOKEN_PLUS_PLUS) ? OP_ADD : OP_SUBTRACT;
+    advance();
+    emitConstant(NUMBER_VAL(1));
+    return op | COMPOUND_POSTFIX;
+  case TOKEN_PLUS_EQUAL:
+    op = OP_ADD;
+    break;
+  case TOKEN_MINUS_EQUAL:
+    op = OP_SUBTRACT;
+    break;
+  case TOKEN_STAR_EQUAL:
+    op = OP_MULTIPLY;
+    break;
+  case TOKEN_SLASH_EQUAL:
+    op = OP_DIVIDE;
+    break;
+  default:
+    return -1;
+  }
+
+  if (!canAssign)
+    return -1;
+  advance();
+  expression();
+  return op;
+}
+
+static int fieldOffset(uint8_t name) {
+  Value offset;
+  if (!tableGet(&fieldOffsets,
+                AS_STRING(currentChunk()->constants.values[name]), &offset)) {
+    return -1;
+  }
+  return (int)AS_NUMBER(offset);
+}
+
+static bool assignmentFollows(bool canAssign) {
+  // Whether compoundAssignment() or an '=' is next, before either compiles
+  // anything.
+  switch (parser.current.type) {
+  case TOKEN_PLUS_PLUS:
+  case TOKEN_MINUS_MINUS:
+    return true;
+  case TOKEN_EQUAL:
+  case TOKEN_PLUS_EQUAL:
+  case TOKEN_MINUS_EQUAL:
+  case TOKEN_STAR_EQUAL:
+  case TOKEN_SLASH_EQUAL:
+    return canAssign;
+  default:
+    return false;
+  }
+}
+
+#define MAX_FIELD_LINKS 16
+
+// A field read between a variable and the field being assigned, such as
+// '.pos' in 'body.pos.x = 1'. The offset is UINT8_MAX when it isn't known.
+typedef struct {
+  uint8_t name;
+  uint8_t offset;
+} FieldLink;
+
+static int fieldLinks(FieldLink *links) {
+  // Decodes the field reads since the last variable read, or returns -1 if
+  // anything else was compiled since.
+  Chunk *chunk = currentChunk();
+  if (parser.variableEnd == -1 || parser.variableEnd > chunk->count)
+    return -1;
+  int count = 0;
+  for (int offset = parser.variableEnd; offset < chunk->count; count++) {
+    uint8_t *code = &chunk->code[offset];
+    if (count == MAX_FIELD_LINKS ||
+        (code[0] != OP_GET_FIELD && code[0] != OP_GET_PROPERTY)) {
+      return -1;
+    }
+    links[count].name = code[1];
+    links[count].offset = code[0] == OP_GET_FIELD ? code[2] : UINT8_MAX;
+    offset += code[0] == OP_GET_FIELD ? 3 : 2;
+  }
+  return count;
+}
+
 static void dot(bool canAssign) {
+  // Structs never change, so assigning a field makes an updated copy that
+  // has to be stored where the struct came from. That works when the
+  // receiver is a variable, or fields read from one: each receiver is kept
+  // on the stack, and after the assignment each updated one is stored into
+  // the one below it, then the first into the variable.
   consume(TOKEN_IDENTIFIER, "Expect property name after '.'.");
   uint8_t name = identifierConstant(&parser.previous);
+  int offset = fieldOffset(name);
+  int compoundOp;
+
+  FieldLink links[MAX_FIELD_LINKS];
+  int linkCount = -1;
+  uint8_t getOp = parser.variableGetOp;
+  uint8_t setOp = parser.variableSetOp;
+  uint8_t arg = parser.variableArg;
+  if (assignmentFollows(canAssign) && (linkCount = fieldLinks(links)) > 0) {
+    truncateChunk(currentChunk(), parser.variableEnd);
+    for (int i = 0; i < linkCount; i++) {
+      emitByte(OP_DUP);
+      if (links[i].offset == UINT8_MAX) {
+        emitBytes(OP_GET_PROPERTY, links[i].name);
+      } else {
+        emitBytes(OP_GET_FIELD, links[i].name);
+        emitByte(links[i].offset);
+      }
+    }
+  }
+  // Nothing needs storing back into 'this', which is never a struct.
+  bool place = linkCount > 0 || (linkCount == 0 && setOp != OP_POP);
 
   if (canAssign && match(TOKEN_EQUAL)) {
     expression();
-    emitBytes(OP_SET_PROPERTY, name);
-
-  } else if (match(TOKEN_LEFT_PAREN)) {
-    uint8_t argCount = argumentList();
-    emitBytes(OP_INVOKE, name);
-    emitByte(argCount);
+    if (!place) {
+      emitBytes(OP_SET_PROPERTY, name);
+      return;
+    }
+    emitBytes(OP_SET_FIELD, name);
+    emitByte(offset == -1 ? UINT8_MAX : (uint8_t)offset);
+  } else if ((compoundOp = compoundAssignment(canAssign)) != -1) {
+    emitBytes(OP_COMPOUND_PROPERTY, name);
+    if (!place) {
+      emitByte((uint8_t)compoundOp);
+      return;
+    }
+    emitByte((uint8_t)(compoundOp | COMPOUND_UPDATE));
   } else {
-    emitBytes(OP_GET_PROPERTY, name);
+    if (match(TOKEN_LEFT_PAREN)) {
+      uint8_t argCount = argumentList();
+      noteCall();
+      emitBytes(OP_INVOKE, name);
+      emitByte(argCount);
+    } else if (offset != -1) {
+      emitBytes(OP_GET_FIELD, name);
+      emitByte((uint8_t)offset);
+    } else {
+      emitBytes(OP_GET_PROPERTY, name);
+    }
+    return;
+  }
+
+  for (int i = linkCount - 1; i >= 0; i--) {
+    emitBytes(OP_UPDATE_FIELD, links[i].name);
+    emitByte(links[i].offset);
   }
+  if (setOp != OP_POP) {
+    noteWrite(getOp, arg);
+    emitBytes(setOp, arg);
+  }
+  emitByte(OP_POP);
 }
 
 static int resolveLocal(Compiler *compiler, Token *name) {
@@ -394,7 +858,8 @@ static int resolveLocal(Compiler *compiler, Token *name) {
   return -1;
 }
 
-static int addUpvalue(Compiler *compiler, uint8_t index, bool isLocal) {
+static int addUpvalue(Compiler *compiler, uint8_t index, bool isLocal,
+                      StaticType type, bool isConst) {
   int upvalueCount = compiler->function->upvalueCount;
 
   for (int i = 0; i < upvalueCount; i++) {
@@ -410,6 +875,8 @@ static int addUpvalue(Compiler *compiler, uint8_t index, bool isLocal) {
   }
   compiler->upvalues[upvalueCount].isLocal = isLocal;
   compiler->upvalues[upvalueCount].index = index;
+  compiler->upvalues[upvalueCount].type = type;
+  compiler->upvalues[upvalueCount].isConst = isConst;
   return compiler->function->upvalueCount++;
 }
 
@@ -419,13 +886,17 @@ static int resolveUpvalue(Compiler *compiler, Token *name) {
 
   int local = resolveLocal(compiler->enclosing, name);
   if (local != -1) {
-    compiler->enclosing->locals[local].isCaptured = true;
-    return addUpvalue(compiler, (uint8_t)local, true);
+    Local *captured = &compiler->enclosing->locals[local];
+    captured->isCaptured = true;
+    return addUpvalue(compiler, (uint8_t)local, true, captured->type,
+                      captured->isConst);
   }
 
   int upvalue = resolveUpvalue(compiler->enclosing, name);
   if (upvalue != -1) {
-    return addUpvalue(compiler, (uint8_t)upvalue, false);
+    Upvalue *outer = &compiler->enclosing->upvalues[upvalue];
+    return addUpvalue(compiler, (uint8_t)upvalue, false, outer->type,
+                      outer->isConst);
   }
   return -1;
 }
@@ -441,13 +912,40 @@ static void addLocal(Token name) {
   local->depth = -1;
   local->depth = current->scopeDepth;
   local->isCaptured = false;
+  local->isConst = false;
+  local->type = STATIC_ANY;
+  local->infoIndex = -1;
 }
 
-static void declareVariable() {
-  if (current->scopeDepth == 0)
-    return;
+static bool constantGlobal(Token *name, Value *value) {
+  return tableGet(&constGlobals, copyString(name->start, name->length), value);
+}
 
-  Token *name = &parser.previous;
+static StaticType globalType(Token *name) {
+  Value type;
+  if (!tableGet(&globalTypes, copyString(name->start, name->length), &type)) {
+    return STATIC_ANY;
+  }
+  return (StaticType)AS_NUMBER(type);
+}
+
+static void setGlobalType(uint8_t global, StaticType type) {
+  ObjString *name = AS_STRING(currentChunk()->constants.values[global]);
+  if (type == STATIC_ANY) {
+    tableDelete(&globalTypes, name);
+  } else {
+    tableSet(&globalTypes, name, NUMBER_VAL(type));
+  }
+}
+
+static void declareNamedVariable(Token *name) {
+  if (current->scopeDepth == 0) {
+    Value value;
+    if (constantGlobal(name, &value)) {
+      error("Already a constant with this name.");
+    }
+    return;
+  }
 
   for (int i = current->localCount - 1; i >= 0; i--) {
     Local *local = &current->locals[i];
@@ -463,26 +961,80 @@ static void declareVariable() {
   addLocal(*name);
 }
 
+static void declareVariable() { declareNamedVariable(&parser.previous); }
+
 static void namedVariable(Token name, bool canAssign) {
-  uint8_t getOp, setOp;
+  uint8_t getOp, setOp, compoundOp;
+  StaticType type = STATIC_ANY;
+  bool isConst = false;
+  Value constant;
   int arg = resolveLocal(current, &name);
   if (arg != -1) {
     getOp = OP_GET_LOCAL;
     setOp = OP_SET_LOCAL;
+    compoundOp = OP_COMPOUND_LOCAL;
+    type = current->locals[arg].type;
+    isConst = current->locals[arg].isConst;
   } else if ((arg = resolveUpvalue(current, &name)) != -1) {
     getOp = OP_GET_UPVALUE;
     setOp = OP_SET_UPVALUE;
+    compoundOp = OP_COMPOUND_UPVALUE;
+    type = current->upvalues[arg].type;
+    isConst = current->upvalues[arg].isConst;
   } else {
+    isConst = constantGlobal(&name, &constant);
+    if (isConst && !IS_NIL(constant) && !(canAssign && check(TOKEN_EQUAL))) {
+      // Reads of a known constant are inlined; assignments fall through so
+      // they report the error below.
+      if (compoundAssignment(canAssign) != -1) {
+        error("Can't assign to a constant.");
+      }
+      emitValue(constant);
+      return;
+    }
     arg = identifierConstant(&name);
     getOp = OP_GET_GLOBAL;
     setOp = OP_SET_GLOBAL;
+    compoundOp = OP_COMPOUND_GLOBAL;
+    type = globalType(&name);
   }
 
+  int op;
   if (canAssign && match(TOKEN_EQUAL)) {
+    if (isConst) {
+      error("Can't assign to a constant.");
+    }
     expression();
+    emitTypeCheck(type);
+    noteWrite(getOp, (uint8_t)arg);
     emitBytes(setOp, (uint8_t)arg);
+    if (type != STATIC_ANY)
+      parser.exprType = type;
+  } else if ((op = compoundAssignment(canAssign)) != -1) {
+    if (isConst) {
+      error("Can't assign to a constant.");
+    }
+    if (getOp == OP_GET_GLOBAL) {
+      // Arithmetic keeps its operands' type, so a right-hand side of the
+      // declared type keeps the global's.
+      emitTypeCheck(type);
+    }
+    noteWrite(getOp, (uint8_t)arg);
+    emitBytes(compoundOp, (uint8_t)arg);
+    emitByte((uint8_t)op);
+    // Arithmetic on a number either yields a number or raises an error.
+    parser.exprType = type == STATIC_NUMBER ? STATIC_NUMBER : STATIC_ANY;
   } else {
     emitBytes(getOp, (uint8_t)arg);
+    // Code compiled before a global's declaration may have stored anything
+    // in it, so reads of globals aren't typed.
+    parser.exprType = getOp == OP_GET_GLOBAL ? STATIC_ANY : type;
+    if (!isConst) {
+      parser.variableEnd = currentChunk()->count;
+      parser.variableGetOp = getOp;
+      parser.variableSetOp = setOp;
+      parser.variableArg = (uint8_t)arg;
+    }
   }
 }
 
@@ -490,27 +1042,81 @@ static void variable(bool canAssign) {
   namedVariable(parser.previous, canAssign);
 }
 
+static Token syntheticToken(const char *text) {
+  Token token;
+  token.start = text;
+  token.length = (int)strlen(text);
+  return token;
+}
+
+static void super_(bool canAssign) {
+  (void)canAssign;
+  if (currentClass == NULL) {
+    error("Can't use 'super' outside of a class.");
+  } else if (!currentClass->hasSuperclass) {
+    error("Can't use 'super' in a class with no superclass.");
+  }
+
+  consume(TOKEN_DOT, "Expect '.' after 'super'.");
+  consume(TOKEN_IDENTIFIER, "Expect superclass method name.");
+  uint8_t name = identifierConstant(&parser.previous);
+
+  namedVariable(syntheticToken("this"), false);
+  if (match(TOKEN_LEFT_PAREN)) {
+    // The superclass is resolved statically, so the method is called directly
+    // without allocating a bound method.
+    uint8_t argCount = argumentList();
+    namedVariable(syntheticToken("super"), false);
+    noteCall();
+    emitBytes(OP_SUPER_INVOKE, name);
+    emitByte(argCount);
+  } else {
+    namedVariable(syntheticToken("super"), false);
+    emitBytes(OP_GET_SUPER, name);
+  }
+  parser.exprType = STATIC_ANY;
+}
+
 static void this_(bool canAssign) {
   if (currentClass == NULL) {
     error("Can't use 'this' outside of a class");
     return;
   }
   variable(false);
+  parser.variableSetOp = OP_POP;
 }
 
 static void unary(bool canAssign) {
   TokenType operatorType = parser.previous.type;
 
   // Compile the operand
+  int start = currentChunk()->count;
   parsePrecedence(PREC_UNARY);
 
+  Value operand;
+  if (emittedConstant(start, currentChunk()->count, &operand)) {
+    if (operatorType == TOKEN_BANG) {
+      truncateChunk(currentChunk(), start);
+      emitValue(BOOL_VAL(IS_NIL(operand) ||
+                         (IS_BOOL(operand) && !AS_BOOL(operand))));
+      return;
+    }
+    if (operatorType == TOKEN_MINUS && IS_NUMBER(operand)) {
+      truncateChunk(currentChunk(), start);
+      emitValue(NUMBER_VAL(-AS_NUMBER(operand)));
+      return;
+    }
+  }
+
   // Emit the operator instruction
   switch (operatorType) {
   case TOKEN_BANG:
     emitByte(OP_NOT);
+    parser.exprType = STATIC_BOOL;
     break;
   case TOKEN_MINUS:
-    emitByte(OP_NEGATE);
+    emitByte(parser.exprType == STATIC_NUMBER ? OP_NEGATE_NUM : OP_NEGATE);
+    parser.exprType = STATIC_NUMBER;
     break;
   default:
     return;
@@ -559,18 +1165,25 @@ static void list(bool canAssign) {
 
   emitByte(OP_BUILD_LIST);
   emitByte(itemCount);
+  parser.exprType = STATIC_ANY;
   return;
 }
 
 static void subscript(bool canAssign) {
+  int listStart = parser.leftStart;
+  int indexStart = currentChunk()->count;
   parsePrecedence(PREC_OR);
   consume(TOKEN_RIGHT_BRACKET, "Expect ']' after index.");
+  ListLoop *loop = boundingLoop(listStart, indexStart);
+  int compoundOp;
 
   if (canAssign && match(TOKEN_EQUAL)) {
     expression();
-    emitByte(OP_STORE_SUBSCR);
+    emitSubscript(loop, OP_STORE_SUBSCR, OP_STORE_LIST);
+  } else if ((compoundOp = compoundAssignment(canAssign)) != -1) {
+    emitBytes(OP_COMPOUND_SUBSCR, (uint8_t)compoundOp);
   } else {
-    emitByte(OP_INDEX_SUBSCR);
+    emitSubscript(loop, OP_INDEX_SUBSCR, OP_INDEX_LIST);
   }
   return;
 }
@@ -597,6 +1210,12 @@ ParseRule rules[] = {
     [TOKEN_GREATER_EQUAL] = {NULL, binary, PREC_COMPARISON},
     [TOKEN_LESS] = {NULL, binary, PREC_COMPARISON},
     [TOKEN_LESS_EQUAL] = {NULL, binary, PREC_COMPARISON},
+    [TOKEN_MINUS_EQUAL] = {NULL, NULL, PREC_NONE},
+    [TOKEN_MINUS_MINUS] = {NULL, NULL, PREC_NONE},
+    [TOKEN_PLUS_EQUAL] = {NULL, NULL, PREC_NONE},
+    [TOKEN_PLUS_PLUS] = {NULL, NULL, PREC_NONE},
+    [TOKEN_SLASH_EQUAL] = {NULL, NULL, PREC_NONE},
+    [TOKEN_STAR_EQUAL] = {NULL, NULL, PREC_NONE},
     [TOKEN_IDENTIFIER] = {variable, NULL, PREC_NONE},
     [TOKEN_STRING] = {string, NULL, PREC_NONE},
     [TOKEN_NUMBER] = {number, NULL, PREC_NONE},
@@ -614,11 +1233,12 @@ ParseRule rules[] = {
     [TOKEN_OR] = {NULL, or_, PREC_OR},
     [TOKEN_PRINT] = {NULL, NULL, PREC_NONE},
     [TOKEN_RETURN] = {NULL, NULL, PREC_NONE},
-    [TOKEN_SUPER] = {NULL, NULL, PREC_NONE},
+    [TOKEN_SUPER] = {super_, NULL, PREC_NONE},
     [TOKEN_THIS] = {this_, NULL, PREC_NONE},
     [TOKEN_TRUE] = {literal, NULL, PREC_NONE},
     [TOKEN_VAR] = {NULL, NULL, PREC_NONE},
     [TOKEN_WHILE] = {NULL, NULL, PREC_NONE},
+    [TOKEN_IN] = {NULL, binary, PREC_COMPARISON},
     [TOKEN_ERROR] = {NULL, NULL, PREC_NONE},
     [TOKEN_EOF] = {NULL, NULL, PREC_NONE},
 };
@@ -632,15 +1252,27 @@ static void parsePrecedence(Precedence precedence) {
   }
 
   bool canAssign = precedence <= PREC_ASSIGNMENT;
+  int start = currentChunk()->count;
+  parser.exprType = STATIC_ANY;
   prefixRule(canAssign);
 
   while (precedence <= getRule(parser.current.type)->precedence) {
     advance();
     ParseFn infixRule = getRule(parser.previous.type)->infix;
+    parser.leftType = parser.exprType;
+    parser.leftStart = start;
+    parser.exprType = STATIC_ANY;
     infixRule(canAssign);
+    // Only binary operators track their result type; the others may have
+    // compiled nested expressions that left a stale one behind.
+    if (infixRule != binary)
+      parser.exprType = STATIC_ANY;
   }
 
-  if (canAssign && match(TOKEN_EQUAL)) {
+  if (canAssign &&
+      (match(TOKEN_EQUAL) || match(TOKEN_PLUS_EQUAL) ||
+       match(TOKEN_MINUS_EQUAL) || match(TOKEN_STAR_EQUAL) ||
+       match(TOKEN_SLASH_EQUAL))) {
     error("Invalid assignment type");
   }
 }
@@ -658,7 +1290,14 @@ static uint8_t parseVariable(const char *errorMessage) {
 static void markInitialized() {
   if (current->scopeDepth == 0)
     return;
-  current->locals[current->localCount - 1].depth = current->scopeDepth;
+  Local *local = &current->locals[current->localCount - 1];
+  local->depth = current->scopeDepth;
+  // Only the debugger reads local names, so other runs skip recording them.
+  if (local->name.length > 0 && debuggerEnabled()) {
+    local->infoIndex = addLocalInfo(
+        currentChunk(), copyString(local->name.start, local->name.length),
+        current->localCount - 1, currentChunk()->count);
+  }
 }
 
 static void defineVariable(uint8_t global) {
@@ -668,23 +1307,129 @@ static void defineVariable(uint8_t global) {
   }
 
   emitBytes(OP_DEFINE_GLOBAL, global);
+  setGlobalType(global, STATIC_ANY);
 }
 
 static ParseRule *getRule(TokenType type) { return &rules[type]; }
 
 static void expression() { parsePrecedence(PREC_ASSIGNMENT); }
 
+static void multiVarDeclaration(Token first) {
+  // let a, b, ... = f();
+  // The values the call returns are left on the stack in order, so each one
+  // already sits in the slot its local will occupy.
+  Token names[UINT8_MAX];
+  int nameCount = 0;
+  names[nameCount++] = first;
+  do {
+    consume(TOKEN_IDENTIFIER, "Expect variable name");
+    if (nameCount == UINT8_MAX) {
+      error("Can't declare more than 255 variables at once.");
+    } else {
+      names[nameCount++] = parser.previous;
+    }
+  } while (match(TOKEN_COMMA));
+
+  consume(TOKEN_EQUAL, "Expect '=' after variable names");
+  expression();
+  consume(TOKEN_SEMICOLON, "Expect ';' after variable declaration");
+  emitBytes(OP_UNPACK, (uint8_t)nameCount);
+
+  if (current->scopeDepth > 0) {
+    for (int i = 0; i < nameCount; i++) {
+      declareNamedVariable(&names[i]);
+      markInitialized();
+    }
+    return;
+  }
+
+  // OP_DEFINE_GLOBAL pops, so define from the top of the stack down.
+  for (int i = nameCount - 1; i >= 0; i--) {
+    defineVariable(identifierConstant(&names[i]));
+  }
+}
+
+static StaticType typeAnnotation() {
+  if (!match(TOKEN_COLON))
+    return STATIC_ANY;
+
+  consume(TOKEN_IDENTIFIER, "Expect type name after ':'.");
+  Token *name = &parser.previous;
+  for (int type = STATIC_ANY; type <= STATIC_BOOL; type++) {
+    const char *typeName = staticTypeName((StaticType)type);
+    if (name->length == (int)strlen(typeName) &&
+        memcmp(name->start, typeName, name->length) == 0) {
+      return (StaticType)type;
+    }
+  }
+  error("Unknown type name.");
+  return STATIC_ANY;
+}
+
 static void varDeclaration() {
-  uint8_t global = parseVariable("Expect variable name");
+  consume(TOKEN_IDENTIFIER, "Expect variable name");
+  Token name = parser.previous;
+  if (match(TOKEN_COMMA)) {
+    multiVarDeclaration(name);
+    return;
+  }
+
+  declareNamedVariable(&name);
+  uint8_t global = current->scopeDepth > 0 ? 0 : identifierConstant(&name);
+  StaticType type = typeAnnotation();
 
   if (match(TOKEN_EQUAL)) {
     expression();
+    emitTypeCheck(type);
   } else {
+    if (type != STATIC_ANY) {
+      error("A typed variable needs an initializer.");
+    }
     emitByte(OP_NIL);
   }
   consume(TOKEN_SEMICOLON, "Expect ';' after variable declaration");
 
   defineVariable(global);
+  // Globals can be reassigned from code compiled earlier, so only locals
+  // keep their type for later reads. Assignments to either are checked.
+  if (current->scopeDepth > 0) {
+    current->locals[current->localCount - 1].type = type;
+  } else {
+    setGlobalType(global, type);
+  }
+}
+
+static void constDeclaration() {
+  consume(TOKEN_IDENTIFIER, "Expect constant name.");
+  Token name = parser.previous;
+  declareNamedVariable(&name);
+  uint8_t global = current->scopeDepth > 0 ? 0 : identifierConstant(&name);
+  StaticType type = typeAnnotation();
+
+  consume(TOKEN_EQUAL, "Expect '=' after constant name.");
+  int start = currentChunk()->count;
+  expression();
+  emitTypeCheck(type);
+  consume(TOKEN_SEMICOLON, "Expect ';' after constant declaration.");
+
+  if (current->scopeDepth > 0) {
+    // A local is already a stack slot, so there's nothing to inline. Since
+    // it never changes, its type is whatever the initializer produced.
+    defineVariable(global);
+    Local *local = &current->locals[current->localCount - 1];
+    local->isConst = true;
+    local->type = type != STATIC_ANY ? type : parser.exprType;
+    return;
+  }
+
+  // The global is still defined for code compiled before this point.
+  Value value;
+  if (!emittedConstant(start, currentChunk()->count, &value)) {
+    value = NIL_VAL;
+  }
+  tableSet(&constGlobals,
+           AS_STRING(currentChunk()->constants.values[global]), value);
+  defineVariable(global);
 }
 
 static void expressionStatement() {
@@ -693,9 +1438,67 @@ static void expressionStatement() {
   emitByte(OP_POP);
 }
 
+static bool nonNegativeConstant(uint8_t constant) {
+  Value value = currentChunk()->constants.values[constant];
+  return IS_NUMBER(value) && AS_NUMBER(value) >= 0;
+}
+
+static bool indexInitializer(int start, int localCount) {
+  // let i = n, for a non-negative number n.
+  Chunk *chunk = currentChunk();
+  return current->localCount == localCount + 1 &&
+         chunk->count == start + 2 && chunk->code[start] == OP_CONSTANT &&
+         nonNegativeConstant(chunk->code[start + 1]);
+}
+
+static bool boundsCondition(int start, ListLoop *loop) {
+  // i < xs.len(), where xs is any other variable.
+  Chunk *chunk = currentChunk();
+  uint8_t *code = &chunk->code[start];
+  if (chunk->count != start + 8 || code[0] != OP_GET_LOCAL ||
+      code[1] != loop->indexSlot || code[4] != OP_INVOKE || code[6] != 0 ||
+      code[7] != OP_LESS) {
+    return false;
+  }
+  if (code[2] != OP_GET_LOCAL && code[2] != OP_GET_UPVALUE &&
+      code[2] != OP_GET_GLOBAL) {
+    return false;
+  }
+  if (code[2] == OP_GET_LOCAL && code[3] == loop->indexSlot)
+    return false;
+
+  ObjString *name = AS_STRING(chunk->constants.values[code[5]]);
+  if (name->length != 3 || memcmp(name->chars, "len", 3) != 0)
+    return false;
+  loop->listOp = code[2];
+  loop->listArg = code[3];
+  return true;
+}
+
+static bool indexIncrement(int start, uint8_t slot) {
+  // i++, i += n or i = i + n, for a non-negative constant n, then the pop.
+  Chunk *chunk = currentChunk();
+  uint8_t *code = &chunk->code[start];
+  switch (chunk->count - start) {
+  case 6:
+    return code[0] == OP_CONSTANT && nonNegativeConstant(code[1]) &&
+           code[2] == OP_COMPOUND_LOCAL && code[3] == slot &&
+           (code[4] & ~COMPOUND_POSTFIX) == OP_ADD && code[5] == OP_POP;
+  case 8:
+    return code[0] == OP_GET_LOCAL && code[1] == slot &&
+           code[2] == OP_CONSTANT && nonNegativeConstant(code[3]) &&
+           (code[4] == OP_ADD || code[4] == OP_ADD_NUM) &&
+           code[5] == OP_SET_LOCAL && code[6] == slot && code[7] == OP_POP;
+  default:
+    return false;
+  }
+}
+
 static void forStatement() {
   beginScope();
   consume(TOKEN_LEFT_PAREN, "Expect '(' after 'for'.");
+  int initializerStart = currentChunk()->count;
+  int localCount = current->localCount;
   if (match(TOKEN_SEMICOLON)) {
     // No initializer.
   } else if (match(TOKEN_VAR)) {
@@ -703,13 +1506,30 @@ static void forStatement() {
   } else {
     expressionStatement();
   }
-  consume(TOKEN_SEMICOLON, "Expect ';'.");
+
+  // Leave room for a guard in case this turns out to be an indexed loop
+  // over a list. Breakpoints patch code the guard would have to walk, so
+  // debugged programs keep every check.
+  ListLoop loop;
+  loop.eligible = false;
+  loop.indexSlot = (uint8_t)localCount;
+  loop.siteCount = 0;
+  int guard = -1;
+  if (!debuggerEnabled() && indexInitializer(initializerStart, localCount)) {
+    guard = currentChunk()->count;
+    for (int i = 0; i < 5; i++) {
+      emitByte(OP_NIL);
+    }
+    clearLoopGuard(currentChunk(), guard);
+  }
 
   int loopStart = currentChunk()->count;
 
   int exitJump = -1;
   if (!match(TOKEN_SEMICOLON)) {
+    int conditionStart = currentChunk()->count;
     expression();
+    loop.eligible = guard != -1 && boundsCondition(conditionStart, &loop);
     consume(TOKEN_SEMICOLON, "Expect ';' after loop condition.");
 
     // Jump out of the loop if the condition is false.
@@ -722,18 +1542,38 @@ static void forStatement() {
     expression();
     emitByte(OP_POP);
     consume(TOKEN_RIGHT_PAREN, "Expect ')' after for clauses.");
+    loop.eligible =
+        loop.eligible && indexIncrement(incrementStart, loop.indexSlot);
 
     emitLoop(loopStart);
     loopStart = incrementStart;
     patchJump(bodyJump);
   }
+
+  loop.enclosing = current->listLoop;
+  current->listLoop = &loop;
   statement();
+  current->listLoop = loop.enclosing;
   emitLoop(loopStart);
 
   if (exitJump != -1) {
     patchJump(exitJump);
     emitByte(OP_POP); // Condition.
   }
+
+  if (loop.eligible && loop.siteCount > 0) {
+    int length = currentChunk()->count - (guard + 5);
+    if (length > UINT16_MAX) {
+      disqualifyListLoop(&loop);
+    } else {
+      uint8_t *code = &currentChunk()->code[guard];
+      code[0] = loop.listOp;
+      code[1] = loop.listArg;
+      code[2] = OP_GUARD_LIST;
+      code[3] = (length >> 8) & 0xff;
+      code[4] = length & 0xff;
+    }
+  }
   endScope();
 }
 
@@ -772,12 +1612,56 @@ static void returnStatement() {
     if (current->type == TYPE_INITIALIZER) {
       error("Can't return a value from an initializer");
     }
-    expression();
+    int returnCount = 0;
+    do {
+      expression();
+      emitTypeCheck(current->returnType);
+      if (returnCount == UINT8_MAX) {
+        error("Can't return more than 255 values.");
+      }
+      returnCount++;
+    } while (match(TOKEN_COMMA));
     consume(TOKEN_SEMICOLON, "Expect ';' after return value");
-    emitByte(OP_RETURN);
+    emitBytes(OP_RETURN, (uint8_t)returnCount);
   }
 }
 
+static void throwStatement() {
+  expression();
+  consume(TOKEN_SEMICOLON, "Expect ';' after thrown value.");
+  emitByte(OP_THROW);
+}
+
+static void tryStatement() {
+  // The try block is recorded in the chunk's handler table rather than
+  // compiled to instructions; only a jump over the handler is emitted.
+  int stackDepth = current->localCount;
+  int start = currentChunk()->count;
+  consume(TOKEN_LEFT_BRACE, "Expect '{' after 'try'.");
+  beginScope();
+  block();
+  endScope();
+  int end = currentChunk()->count;
+  int skipHandler = emitJump(OP_JUMP);
+
+  // The VM pushes the exception as the handler starts, so it becomes the
+  // catch variable's slot.
+  int handler = currentChunk()->count;
+  consume(TOKEN_CATCH, "Expect 'catch' after try block.");
+  consume(TOKEN_LEFT_PAREN, "Expect '(' after 'catch'.");
+  consume(TOKEN_IDENTIFIER, "Expect exception variable name.");
+  beginScope();
+  addLocal(parser.previous);
+  markInitialized();
+  consume(TOKEN_RIGHT_PAREN, "Expect ')' after exception variable.");
+  consume(TOKEN_LEFT_BRACE, "Expect '{' before catch body.");
+  block();
+  endScope();
+
+  patchJump(skipHandler);
+  addHandler(currentChunk(), start, end, handler, stackDepth);
+}
+
 static void whileStatement() {
   int loopStart = currentChunk()->count;
   consume(TOKEN_LEFT_PAREN, "Expect '(' after 'while'");
@@ -801,6 +1685,8 @@ static void synchronize() {
       return;
     switch (parser.current.type) {
     case TOKEN_CLASS:
+    case TOKEN_STRUCT:
+    case TOKEN_CONST:
     case TOKEN_FUN:
     case TOKEN_VAR:
     case TOKEN_FOR:
@@ -808,6 +1694,8 @@ static void synchronize() {
     case TOKEN_WHILE:
     case TOKEN_PRINT:
     case TOKEN_RETURN:
+    case TOKEN_TRY:
+    case TOKEN_THROW:
       return;
 
     default:; // Do nothing.
@@ -824,6 +1712,12 @@ static void switchStatement() {
   consume(TOKEN_RIGHT_PAREN, "Expect ')' after value.");
   consume(TOKEN_LEFT_BRACE, "Expect '{' before switch cases.");
 
+  // Hold the value in a hidden local so that slots stay numbered correctly
+  // for locals and try blocks inside the cases.
+  beginScope();
+  addLocal(syntheticToken(""));
+  markInitialized();
+
   int state = 0; // 0: before all cases, 1: before default, 2: after default.
   int caseEnds[MAX_CASES];
   int caseCount = 0;
@@ -887,11 +1781,9 @@ static void switchStatement() {
     patchJump(caseEnds[i]);
   }
 
-  emitByte(OP_POP); // The switch value.
+  endScope(); // Pops the switch value.
 }
 
-static void block();
-
 static void function(FunctionType type) {
   Compiler compiler;
   initCompiler(&compiler, type);
@@ -906,9 +1798,21 @@ static void function(FunctionType type) {
       }
       uint8_t constant = parseVariable("Expect parameter name");
       defineVariable(constant);
+      current->locals[current->localCount - 1].type = typeAnnotation();
     } while (match(TOKEN_COMMA));
   }
   consume(TOKEN_RIGHT_PAREN, "Expect ')' after parameters");
+  current->returnType = typeAnnotation();
+
+  // Typed parameters are checked once on entry, so the body can trust them.
+  for (int slot = 1; slot < current->localCount; slot++) {
+    StaticType type = current->locals[slot].type;
+    if (type != STATIC_ANY) {
+      emitBytes(OP_GET_LOCAL, (uint8_t)slot);
+      emitBytes(OP_CHECK_TYPE, (uint8_t)type);
+      emitByte(OP_POP);
+    }
+  }
   consume(TOKEN_LEFT_BRACE, "Expect '{' before function body");
   block();
 
@@ -943,9 +1847,27 @@ static void classDeclaration() {
   defineVariable(nameConstant);
 
   ClassCompiler classCompiler;
+  classCompiler.hasSuperclass = false;
   classCompiler.enclosing = currentClass;
   currentClass = &classCompiler;
 
+  if (match(TOKEN_LESS)) {
+    consume(TOKEN_IDENTIFIER, "Expect superclass name.");
+    variable(false);
+
+    if (identifiersEqual(&className, &parser.previous)) {
+      error("A class can't inherit from itself.");
+    }
+
+    beginScope();
+    addLocal(syntheticToken("super"));
+    defineVariable(0);
+
+    namedVariable(className, false);
+    emitByte(OP_INHERIT);
+    classCompiler.hasSuperclass = true;
+  }
+
   namedVariable(className, false);
   consume(TOKEN_LEFT_BRACE, "Expect '{' before class body.");
   while (!check(TOKEN_RIGHT_BRACE) && !check(TOKEN_EOF)) {
@@ -954,9 +1876,61 @@ static void classDeclaration() {
   consume(TOKEN_RIGHT_BRACE, "Expect '}' after class body.");
   emitByte(OP_POP);
 
+  if (classCompiler.hasSuperclass) {
+    endScope();
+  }
+
   currentClass = currentClass->enclosing;
 }
 
+static void recordFieldOffset(ObjString *name, int offset) {
+  Value existing;
+  if (tableGet(&fieldOffsets, name, &existing) &&
+      AS_NUMBER(existing) != offset) {
+    offset = -1;
+  }
+  tableSet(&fieldOffsets, name, NUMBER_VAL(offset));
+}
+
+static void structDeclaration() {
+  consume(TOKEN_IDENTIFIER, "Expect struct name.");
+  uint8_t nameConstant = identifierConstant(&parser.previous);
+  declareVariable();
+
+  consume(TOKEN_LEFT_BRACE, "Expect '{' before struct fields.");
+  Token names[UINT8_MAX];
+  uint8_t fields[UINT8_MAX];
+  int fieldCount = 0;
+  while (!check(TOKEN_RIGHT_BRACE) && !check(TOKEN_EOF)) {
+    consume(TOKEN_IDENTIFIER, "Expect field name.");
+    for (int i = 0; i < fieldCount; i++) {
+      if (identifiersEqual(&names[i], &parser.previous)) {
+        error("Already a field with this name in this struct.");
+      }
+    }
+    if (fieldCount == UINT8_MAX) {
+      error("Can't have more than 255 fields in a struct.");
+    } else {
+      names[fieldCount] = parser.previous;
+      fields[fieldCount] = identifierConstant(&parser.previous);
+      recordFieldOffset(
+          AS_STRING(currentChunk()->constants.values[fields[fieldCount]]),
+          fieldCount);
+      fieldCount++;
+    }
+    if (!match(TOKEN_COMMA))
+      break;
+  }
+  consume(TOKEN_RIGHT_BRACE, "Expect '}' after struct fields.");
+
+  emitBytes(OP_STRUCT, nameConstant);
+  emitByte((uint8_t)fieldCount);
+  for (int i = 0; i < fieldCount; i++) {
+    emitByte(fields[i]);
+  }
+  defineVariable(nameConstant);
+}
+
 static void funDeclaration() {
   uint8_t global = parseVariable("Expect function name.");
   markInitialized();
@@ -967,11 +1941,15 @@ static void funDeclaration() {
 static void declaration() {
   if (match(TOKEN_CLASS)) {
     classDeclaration();
+  } else if (match(TOKEN_STRUCT)) {
+    structDeclaration();
   } else if (match(TOKEN_FUN)) {
     funDeclaration();
   } else if (match(TOKEN_VAR)) {
     printf("VAR DECLARATION\n");
     varDeclaration();
+  } else if (match(TOKEN_CONST)) {
+    constDeclaration();
   } else {
     statement();
   }
@@ -993,6 +1971,10 @@ static void statement() {
     printStatement();
   } else if (match(TOKEN_SWITCH)) {
     switchStatement();
+  } else if (match(TOKEN_TRY)) {
+    tryStatement();
+  } else if (match(TOKEN_THROW)) {
+    throwStatement();
   } else if (match(TOKEN_FOR)) {
     forStatement();
   } else if (match(TOKEN_IF)) {
@@ -1018,6 +2000,11 @@ ObjFunction *compile(const char *source) {
 
   parser.hadError = false;
   parser.panicMode = false;
+  initTable(&fieldOffsets);
+  initTable(&constGlobals);
+  tableAddAll(&vm.constGlobals, &constGlobals);
+  initTable(&globalTypes);
+  tableAddAll(&vm.globalTypes, &globalTypes);
 
   advance();
 
@@ -1025,6 +2012,15 @@ ObjFunction *compile(const char *source) {
     declaration();
   }
   ObjFunction *function = endCompiler();
+  if (!parser.hadError) {
+    tableAddAll(&constGlobals, &vm.constGlobals);
+    freeTable(&vm.globalTypes);
+    initTable(&vm.globalTypes);
+    tableAddAll(&globalTypes, &vm.globalTypes);
+  }
+  freeTable(&fieldOffsets);
+  freeTable(&constGlobals);
+  freeTable(&globalTypes);
   return parser.hadError ? NULL : function;
 }
 
@@ -1034,4 +2030,7 @@ void markCompilerRoots() {
     markObject((Obj *)compiler->function);
     compiler = compiler->enclosing;
   }
+  markTable(&fieldOffsets);
+  markTable(&constGlobals);
+  markTable(&globalTypes);
 }
@@ -10,6 +10,12 @@ void disassembleChunk(Chunk *chunk, const char *name) {
   for (int offset = 0; offset < chunk->count;) {
     offset = disassembleInstruction(chunk, offset);
   }
+
+  for (int i = 0; i < chunk->handlerCount; i++) {
+    ExceptionHandler *handler = &chunk->handlers[i];
+    printf("try %04d-%04d -> %04d (depth %d)\n", handler->start, handler->end,
+           handler->handler, handler->stackDepth);
+  }
 }
 
 static int simpleInstruction(const char *name, int offset) {
@@ -48,6 +54,58 @@ static int invokeInstruction(const char *name, Chunk *chunk, int offset) {
   return offset + 3;
 }
 
+static const char *compoundOperator(uint8_t op) {
+  bool postfix = (op & COMPOUND_POSTFIX) != 0;
+  switch (op & ~(COMPOUND_POSTFIX | COMPOUND_UPDATE)) {
+  case OP_ADD:
+    return postfix ? "++" : "+=";
+  case OP_SUBTRACT:
+    return postfix ? "--" : "-=";
+  case OP_MULTIPLY:
+    return "*=";
+  case OP_DIVIDE:
+    return "/=";
+  default:
+    return "?";
+  }
+}
+
+static int compoundByteInstruction(const char *name, Chunk *chunk,
+                                   int offset) {
+  uint8_t slot = chunk->code[offset + 1];
+  uint8_t op = chunk->code[offset + 2];
+  printf("%-16s %4d %s\n", name, slot, compoundOperator(op));
+  return offset + 3;
+}
+
+static int compoundConstantInstruction(const char *name, Chunk *chunk,
+                                       int offset) {
+  uint8_t constant = chunk->code[offset + 1];
+  uint8_t op = chunk->code[offset + 2];
+  printf("%-16s %4d '", name, constant);
+  printValue(chunk->constants.values[constant]);
+  printf("' %s\n", compoundOperator(op));
+  return offset + 3;
+}
+
+static int fieldInstruction(const char *name, Chunk *chunk, int offset) {
+  uint8_t constant = chunk->code[offset + 1];
+  uint8_t index = chunk->code[offset + 2];
+  printf("%-16s %4d '", name, constant);
+  printValue(chunk->constants.values[constant]);
+  printf("' @%d\n", index);
+  return offset + 3;
+}
+
+static int structInstruction(const char *name, Chunk *chunk, int offset) {
+  uint8_t constant = chunk->code[offset + 1];
+  uint8_t fieldCount = chunk->code[offset + 2];
+  printf("%-16s %4d '", name, constant);
+  printValue(chunk->constants.values[constant]);
+  printf("' (%d fields)\n", fieldCount);
+  return offset + 3 + fieldCount;
+}
+
 static int longConstantInstruction(const char *name, Chunk *chunk, int offset) {
   uint32_t constant = chunk->code[offset + 1] | (chunk->code[offset + 2] << 8) |
                       (chunk->code[offset + 3] << 16);
@@ -96,16 +154,38 @@ int disassembleInstruction(Chunk *chunk, int offset) {
     return byteInstruction("OP_GET_UPVALUE", chunk, offset);
   case OP_SET_UPVALUE:
     return byteInstruction("OP_SET_UPVALUE", chunk, offset);
+  case OP_COMPOUND_LOCAL:
+    return compoundByteInstruction("OP_COMPOUND_LOCAL", chunk, offset);
+  case OP_COMPOUND_GLOBAL:
+    return compoundConstantInstruction("OP_COMPOUND_GLOBAL", chunk, offset);
+  case OP_COMPOUND_UPVALUE:
+    return compoundByteInstruction("OP_COMPOUND_UPVALUE", chunk, offset);
+  case OP_COMPOUND_PROPERTY:
+    return compoundConstantInstruction("OP_COMPOUND_PROPERTY", chunk, offset);
+  case OP_COMPOUND_SUBSCR:
+    printf("%-16s %s\n", "OP_COMPOUND_SUBSCR",
+           compoundOperator(chunk->code[offset + 1]));
+    return offset + 2;
   case OP_GET_PROPERTY:
     return constantInstruction("OP_GET_PROPERTY", chunk, offset);
   case OP_SET_PROPERTY:
     return constantInstruction("OP_SET_PROPERTY", chunk, offset);
+  case OP_GET_FIELD:
+    return fieldInstruction("OP_GET_FIELD", chunk, offset);
+  case OP_SET_FIELD:
+    return fieldInstruction("OP_SET_FIELD", chunk, offset);
+  case OP_UPDATE_FIELD:
+    return fieldInstruction("OP_UPDATE_FIELD", chunk, offset);
+  case OP_GET_SUPER:
+    return constantInstruction("OP_GET_SUPER", chunk, offset);
   case OP_EQUAL:
     return simpleInstruction("OP_EQUAL", offset);
   case OP_GREATER:
     return simpleInstruction("OP_GREATER", offset);
   case OP_LESS:
     return simpleInstruction("OP_LESS", offset);
+  case OP_IN:
+    return simpleInstruction("OP_IN", offset);
   case OP_ADD:
     return simpleInstruction("OP_ADD", offset);
   case OP_SUBTRACT:
@@ -118,12 +198,30 @@ int disassembleInstruction(Chunk *chunk, int offset) {
     return simpleInstruction("OP_NOT", offset);
   case OP_NEGATE:
     return simpleInstruction("OP_NEGATE", offset);
+  case OP_ADD_NUM:
+    return simpleInstruction("OP_ADD_NUM", offset);
+  case OP_SUBTRACT_NUM:
+    return simpleInstruction("OP_SUBTRACT_NUM", offset);
+  case OP_MULTIPLY_NUM:
+    return simpleInstruction("OP_MULTIPLY_NUM", offset);
+  case OP_DIVIDE_NUM:
+    return simpleInstruction("OP_DIVIDE_NUM", offset);
+  case OP_GREATER_NUM:
+    return simpleInstruction("OP_GREATER_NUM", offset);
+  case OP_LESS_NUM:
+    return simpleInstruction("OP_LESS_NUM", offset);
+  case OP_NEGATE_NUM:
+    return simpleInstruction("OP_NEGATE_NUM", offset);
+  case OP_CHECK_TYPE:
+    printf("%-16s %s\n", "OP_CHECK_TYPE",
+           staticTypeName((StaticType)chunk->code[offset + 1]));
+    return offset + 2;
   case OP_PRINT:
     return simpleInstruction("OP_PRINT", offset);
   case OP_JUMP:
     return jumpInstruction("OP_JUMP", 1, chunk, offset);
   case OP_BREAK:
-    return jumpInstruction("OP_BREAK", 1, chunk, offset);
+    return simpleInstruction("OP_BREAK", offset);
   case OP_JUMP_IF_FALSE:
     return jumpInstruction("OP_JUMP_IF_FALSE", 1, chunk, offset);
   case OP_LOOP:
@@ -132,6 +230,8 @@ int disassembleInstruction(Chunk *chunk, int offset) {
     return byteInstruction("OP_CALL", chunk, offset);
   case OP_INVOKE:
     return invokeInstruction("OP_INVOKE", chunk, offset);
+  case OP_SUPER_INVOKE:
+    return invokeInstruction("OP_SUPER_INVOKE", chunk, offset);
   case OP_CLOSURE: {
     offset++;
     uint8_t constant = chunk->code[offset++];
@@ -149,18 +249,34 @@ int disassembleInstruction(Chunk *chunk, int offset) {
   } break;
   case OP_BUILD_LIST:
     return byteInstruction("OP_BUILD_LIST", chunk, offset);
+  case OP_BUILD_TUPLE:
+    return byteInstruction("OP_BUILD_TUPLE", chunk, offset);
   case OP_INDEX_SUBSCR:
     return simpleInstruction("OP_INDEX_SUBSCR", offset);
+  case OP_INDEX_LIST:
+    return simpleInstruction("OP_INDEX_LIST", offset);
+  case OP_STORE_LIST:
+    return simpleInstruction("OP_STORE_LIST", offset);
+  case OP_GUARD_LIST:
+    return jumpInstruction("OP_GUARD_LIST", 1, chunk, offset);
   case OP_STORE_SUBSCR:
     return simpleInstruction("OP_STORE_SUBSCR", offset);
   case OP_CLOSE_UPVALUE:
     return simpleInstruction("OP_CLOSE_UPVALUE", offset);
   case OP_RETURN:
-    return simpleInstruction("OP_RETURN", offset);
+    return byteInstruction("OP_RETURN", chunk, offset);
+  case OP_UNPACK:
+    return byteInstruction("OP_UNPACK", chunk, offset);
+  case OP_THROW:
+    return simpleInstruction("OP_THROW", offset);
   case OP_CLASS:
     return constantInstruction("OP_CLASS", chunk, offset);
+  case OP_INHERIT:
+    return simpleInstruction("OP_INHERIT", offset);
   case OP_METHOD:
     return constantInstruction("OP_METHOD", chunk, offset);
+  case OP_STRUCT:
+    return structInstruction("OP_STRUCT", chunk, offset);
   default:
     printf("Unknown opcode %d\n", instruction);
     return offset + 1;
@@ -0,0 +1,303 @@
+#include "debugger.h"
+#include "chunk.h"
+#include "memory.h"
+#include "value.h"
+#include "vm.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// A line-oriented debugger driven over stdin/stdout.
+//
+// Breakpoints cost nothing until hit: the instruction byte at a line's start
+// is overwritten with OP_BREAK and the original kept here. When the VM reaches
+// the trap it asks the debugger for the original opcode and dispatches it as
+// if it had been read from the chunk. Stepping works the same way, with
+// temporary traps on every line start that are removed at the next stop.
+
+typedef struct {
+  Chunk *chunk;
+  int offset;
+  uint8_t original;
+  bool isBreakpoint;
+  bool isStep;
+} Trap;
+
+typedef struct {
+  bool enabled;
+  ObjFunction **functions;
+  int functionCount;
+  int functionCapacity;
+  Trap *traps;
+  int trapCount;
+  int trapCapacity;
+} Debugger;
+
+static Debugger debugger;
+
+void enableDebugger() { debugger.enabled = true; }
+
+bool debuggerEnabled() { return debugger.enabled; }
+
+static void addFunction(ObjFunction *function) {
+  if (debugger.functionCapacity < debugger.functionCount + 1) {
+    int oldCapacity = debugger.functionCapacity;
+    debugger.functionCapacity = GROW_CAPACITY(oldCapacity);
+    debugger.functions = GROW_ARRAY(ObjFunction *, debugger.functions,
+                                    oldCapacity, debugger.functionCapacity);
+  }
+  debugger.functions[debugger.functionCount++] = function;
+
+  // Nested functions only exist as constants of their enclosing function.
+  ValueArray *constants = &function->chunk.constants;
+  for (int i = 0; i < constants->count; i++) {
+    if (IS_FUNCTION(constants->values[i])) {
+      addFunction(AS_FUNCTION(constants->values[i]));
+    }
+  }
+}
+
+static Trap *findTrap(Chunk *chunk, int offset) {
+  for (int i = 0; i < debugger.trapCount; i++) {
+    Trap *trap = &debugger.traps[i];
+    if (trap->chunk == chunk && trap->offset == offset)
+      return trap;
+  }
+  return NULL;
+}
+
+static Trap *setTrap(Chunk *chunk, int offset) {
+  Trap *trap = findTrap(chunk, offset);
+  if (trap != NULL)
+    return trap;
+
+  if (debugger.trapCapacity < debugger.trapCount + 1) {
+    int oldCapacity = debugger.trapCapacity;
+    debugger.trapCapacity = GROW_CAPACITY(oldCapacity);
+    debugger.traps =
+        GROW_ARRAY(Trap, debugger.traps, oldCapacity, debugger.trapCapacity);
+  }
+  trap = &debugger.traps[debugger.trapCount++];
+  trap->chunk = chunk;
+  trap->offset = offset;
+  trap->original = chunk->code[offset];
+  trap->isBreakpoint = false;
+  trap->isStep = false;
+  chunk->code[offset] = OP_BREAK;
+  return trap;
+}
+
+static void removeTrap(Trap *trap) {
+  trap->chunk->code[trap->offset] = trap->original;
+  *trap = debugger.traps[--debugger.trapCount];
+}
+
+static void removeTraps(bool breakpoints) {
+  for (int i = debugger.trapCount - 1; i >= 0; i--) {
+    Trap *trap = &debugger.traps[i];
+    if (breakpoints) {
+      trap->isBreakpoint = false;
+    } else {
+      trap->isStep = false;
+    }
+    if (!trap->isBreakpoint && !trap->isStep) {
+      removeTrap(trap);
+    }
+  }
+}
+
+static uint8_t originalOpcode(Chunk *chunk, int offset) {
+  Trap *trap = findTrap(chunk, offset);
+  return trap != NULL ? trap->original : chunk->code[offset];
+}
+
+// Calls visit for the first instruction of each run of code on one line.
+// OP_UNPACK is skipped since OP_RETURN looks for it in the caller's code.
+static int forEachLineStart(ObjFunction *function, int line,
+                            void (*visit)(Chunk *chunk, int offset)) {
+  Chunk *chunk = &function->chunk;
+  int visited = 0;
+  int previousLine = -1;
+  for (int offset = 0; offset < chunk->count;) {
+    int currentLine = getLine(chunk, offset);
+    uint8_t instruction = originalOpcode(chunk, offset);
+    if (currentLine != previousLine && instruction != OP_UNPACK &&
+        (line == -1 || currentLine == line)) {
+      visit(chunk, offset);
+      visited++;
+    }
+    previousLine = currentLine;
+
+    // Measure the instruction with its real opcode in place.
+    uint8_t patched = chunk->code[offset];
+    chunk->code[offset] = instruction;
+    int length = instructionLength(chunk, offset);
+    chunk->code[offset] = patched;
+    offset += length;
+  }
+  return visited;
+}
+
+static void setBreakpoint(Chunk *chunk, int offset) {
+  setTrap(chunk, offset)->isBreakpoint = true;
+}
+
+static void setStepTrap(Chunk *chunk, int offset) {
+  setTrap(chunk, offset)->isStep = true;
+}
+
+static void clearBreakpoint(Chunk *chunk, int offset) {
+  Trap *trap = findTrap(chunk, offset);
+  if (trap != NULL && trap->isBreakpoint) {
+    trap->isBreakpoint = false;
+    if (!trap->isStep)
+      removeTrap(trap);
+  }
+}
+
+static const char *functionName(ObjFunction *function) {
+  return function->name != NULL ? function->name->chars : "script";
+}
+
+static int frameOffset(CallFrame *frame) {
+  return (int)(frame->ip - frame->closure->function->chunk.code) - 1;
+}
+
+static void printBacktrace() {
+  for (int i = vm.frameCount - 1; i >= 0; i--) {
+    CallFrame *frame = &vm.frames[i];
+    ObjFunction *function = frame->closure->function;
+    printf("#%d %s at line %d\n", vm.frameCount - 1 - i, functionName(function),
+           getLine(&function->chunk, frameOffset(frame)));
+  }
+}
+
+static void printLocals(int depth) {
+  if (depth < 0 || depth >= vm.frameCount) {
+    printf("No frame #%d.\n", depth);
+    return;
+  }
+
+  CallFrame *frame = &vm.frames[vm.frameCount - 1 - depth];
+  Chunk *chunk = &frame->closure->function->chunk;
+  int offset = frameOffset(frame);
+  for (int i = 0; i < chunk->localInfoCount; i++) {
+    LocalInfo *info = &chunk->localInfos[i];
+    if (offset >= info->start && offset < info->end) {
+      printf("%s = ", info->name->chars);
+      printValue(frame->slots[info->slot]);
+      printf("\n");
+    }
+  }
+}
+
+static void printStack() {
+  for (Value *slot = vm.stack; slot < vm.stackTop; slot++) {
+    printf("[%d] ", (int)(slot - vm.stack));
+    printValue(*slot);
+    printf("\n");
+  }
+}
+
+static void breakAtLine(int line, bool set) {
+  int found = 0;
+  for (int i = 0; i < debugger.functionCount; i++) {
+    found += forEachLineStart(debugger.functions[i], line,
+                              set ? setBreakpoint : clearBreakpoint);
+  }
+  if (found == 0) {
+    printf("No code at line %d.\n", line);
+  } else {
+    printf("Breakpoint %s at line %d.\n", set ? "set" : "cleared", line);
+  }
+}
+
+static void detach() {
+  removeTraps(true);
+  removeTraps(false);
+}
+
+// Reads and runs commands until one resumes execution.
+static void commandLoop() {
+  char line[256];
+  for (;;) {
+    printf("(debug) ");
+    fflush(stdout);
+    if (!fgets(line, sizeof(line), stdin)) {
+      // No one is listening any more; run the rest at full speed.
+      detach();
+      return;
+    }
+
+    char command[32] = "";
+    int argument = 0;
+    int argumentCount = sscanf(line, "%31s %d", command, &argument);
+
+    if (strcmp(command, "break") == 0 || strcmp(command, "b") == 0) {
+      if (argumentCount < 2) {
+        printf("Usage: break <line>\n");
+      } else {
+        breakAtLine(argument, true);
+      }
+    } else if (strcmp(command, "clear") == 0) {
+      if (argumentCount < 2) {
+        printf("Usage: clear <line>\n");
+      } else {
+        breakAtLine(argument, false);
+      }
+    } else if (strcmp(command, "continue") == 0 ||
+               strcmp(command, "c") == 0) {
+      return;
+    } else if (strcmp(command, "step") == 0 || strcmp(command, "s") == 0) {
+      for (int i = 0; i < debugger.functionCount; i++) {
+        forEachLineStart(debugger.functions[i], -1, setStepTrap);
+      }
+      return;
+    } else if (strcmp(command, "backtrace") == 0 ||
+               strcmp(command, "bt") == 0) {
+      printBacktrace();
+    } else if (strcmp(command, "locals") == 0) {
+      printLocals(argumentCount < 2 ? 0 : argument);
+    } else if (strcmp(command, "stack") == 0) {
+      printStack();
+    } else if (strcmp(command, "quit") == 0 || strcmp(command, "q") == 0) {
+      exit(0);
+    } else if (strcmp(command, "help") == 0) {
+      printf("break <line>, clear <line>, continue, step, backtrace,\n"
+             "locals [frame], stack, quit\n");
+    } else if (command[0] != '\0') {
+      printf("Unknown command '%s'.\n", command);
+    }
+  }
+}
+
+void debuggerAttach(ObjFunction *script) {
+  debugger.functionCount = 0;
+  addFunction(script);
+  commandLoop();
+}
+
+uint8_t debuggerTrap() {
+  CallFrame *frame = &vm.frames[vm.frameCount - 1];
+  ObjFunction *function = frame->closure->function;
+  int offset = frameOffset(frame);
+  uint8_t original = originalOpcode(&function->chunk, offset);
+
+  // Any stop ends a step, so the line-start traps come out first.
+  removeTraps(false);
+  printf("Stopped at line %d in %s.\n", getLine(&function->chunk, offset),
+         functionName(function));
+  commandLoop();
+  return original;
+}
+
+void freeDebugger() {
+  FREE_ARRAY(ObjFunction *, debugger.functions, debugger.functionCapacity);
+  FREE_ARRAY(Trap, debugger.traps, debugger.trapCapacity);
+  debugger.functions = NULL;
+  debugger.functionCount = 0;
+  debugger.functionCapacity = 0;
+  debugger.traps = NULL;
+  debugger.trapCount = 0;
+  debugger.trapCapacity = 0;
+}
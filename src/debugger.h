@@ -0,0 +1,12 @@
+#ifndef clang_debugger_h
+#define clang_debugger_h
+
+#include "object.h"
+
+void enableDebugger();
+bool debuggerEnabled();
+void debuggerAttach(ObjFunction *script);
+uint8_t debuggerTrap();
+void freeDebugger();
+
+#endif // clang_debugger_h
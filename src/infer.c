@@ -0,0 +1,499 @@
+#include "infer.h"
+#include "chunk.h"
+#include "memory.h"
+#include "object.h"
+#include <string.h>
+
+// Flow-sensitive type inference over a finished function's bytecode.
+//
+// The pass simulates the operand stack (locals are its bottom slots) with a
+// StaticType per entry, merging states where jumps meet until nothing
+// changes. Guarded arithmetic and comparisons whose operands are then proven
+// to be numbers are rewritten in place to their unchecked *_NUM forms. Any
+// bytecode the pass doesn't understand leaves the function untouched.
+
+#define INFER_STACK_MAX 512
+
+typedef struct {
+  bool reached;
+  bool queued;
+  int height;
+  uint8_t types[INFER_STACK_MAX];
+} TypeState;
+
+typedef struct {
+  Chunk *chunk;
+  int *blockIndex; // Per offset: index into states for block starts, or -1.
+  TypeState *states;
+  int blockCount;
+  int *worklist;
+  int worklistCount;
+  bool captured[UINT8_COUNT]; // Slots closures may write through upvalues.
+  int lastLocal; // Slot read by the previous instruction, or -1.
+  bool failed;
+} Inference;
+
+static void push(Inference *inf, TypeState *state, StaticType type) {
+  if (state->height >= INFER_STACK_MAX) {
+    inf->failed = true;
+    return;
+  }
+  state->types[state->height++] = (uint8_t)type;
+}
+
+static StaticType pop(Inference *inf, TypeState *state) {
+  if (state->height == 0) {
+    inf->failed = true;
+    return STATIC_ANY;
+  }
+  return (StaticType)state->types[--state->height];
+}
+
+static StaticType peekType(Inference *inf, TypeState *state, int distance) {
+  if (state->height <= distance) {
+    inf->failed = true;
+    return STATIC_ANY;
+  }
+  return (StaticType)state->types[state->height - 1 - distance];
+}
+
+static void popN(Inference *inf, TypeState *state, int count) {
+  for (int i = 0; i < count; i++) {
+    pop(inf, state);
+  }
+}
+
+static void flowTo(Inference *inf, TypeState *state, int target) {
+  if (target < 0 || target >= inf->chunk->count ||
+      inf->blockIndex[target] == -1) {
+    inf->failed = true;
+    return;
+  }
+
+  TypeState *into = &inf->states[inf->blockIndex[target]];
+  bool changed = false;
+  if (!into->reached) {
+    into->reached = true;
+    into->height = state->height;
+    memcpy(into->types, state->types, state->height);
+    changed = true;
+  } else if (into->height != state->height) {
+    inf->failed = true;
+    return;
+  } else {
+    for (int i = 0; i < state->height; i++) {
+      if (into->types[i] != state->types[i] && into->types[i] != STATIC_ANY) {
+        into->types[i] = STATIC_ANY;
+        changed = true;
+      }
+    }
+  }
+
+  if (changed && !into->queued) {
+    into->queued = true;
+    inf->worklist[inf->worklistCount++] = target;
+  }
+}
+
+static uint16_t jumpOperand(Chunk *chunk, int offset) {
+  return (uint16_t)((chunk->code[offset + 1] << 8) | chunk->code[offset + 2]);
+}
+
+static void specialize(Inference *inf, int offset, bool rewrite, OpCode op) {
+  if (rewrite) {
+    inf->chunk->code[offset] = (uint8_t)op;
+  }
+}
+
+// Applies one instruction to state. Returns the next offset to simulate, or
+// -1 when control doesn't fall through.
+static int step(Inference *inf, TypeState *state, int offset, bool rewrite) {
+  Chunk *chunk = inf->chunk;
+  uint8_t *code = chunk->code;
+  int next = offset + instructionLength(chunk, offset);
+  int lastLocal = inf->lastLocal;
+  inf->lastLocal = -1;
+
+  switch (code[offset]) {
+  case OP_CONSTANT:
+    push(inf, state, staticTypeOf(chunk->constants.values[code[offset + 1]]));
+    break;
+  case OP_CONSTANT_LONG: {
+    uint32_t constant =
+        code[offset + 1] | (code[offset + 2] << 8) | (code[offset + 3] << 16);
+    push(inf, state, staticTypeOf(chunk->constants.values[constant]));
+    break;
+  }
+  case OP_NIL:
+  case OP_GET_GLOBAL:
+  case OP_GET_UPVALUE:
+  case OP_CLASS:
+  case OP_STRUCT:
+    push(inf, state, STATIC_ANY);
+    break;
+  case OP_TRUE:
+  case OP_FALSE:
+    push(inf, state, STATIC_BOOL);
+    break;
+  case OP_POP:
+  case OP_DEFINE_GLOBAL:
+  case OP_PRINT:
+  case OP_CLOSE_UPVALUE:
+  case OP_INHERIT:
+  case OP_METHOD:
+  case OP_GUARD_LIST:
+    pop(inf, state);
+    break;
+  case OP_DUP:
+    push(inf, state, peekType(inf, state, 0));
+    break;
+  case OP_GET_LOCAL: {
+    uint8_t slot = code[offset + 1];
+    if (slot >= state->height) {
+      inf->failed = true;
+      break;
+    }
+    push(inf, state,
+         inf->captured[slot] ? STATIC_ANY : (StaticType)state->types[slot]);
+    inf->lastLocal = slot;
+    break;
+  }
+  case OP_SET_LOCAL: {
+    uint8_t slot = code[offset + 1];
+    if (slot >= state->height) {
+      inf->failed = true;
+      break;
+    }
+    state->types[slot] = peekType(inf, state, 0);
+    break;
+  }
+  case OP_SET_GLOBAL:
+  case OP_SET_UPVALUE:
+    break;
+  case OP_CHECK_TYPE: {
+    // A passed check refines the value, and the local it was read from.
+    StaticType type = (StaticType)code[offset + 1];
+    pop(inf, state);
+    push(inf, state, type);
+    if (lastLocal != -1 && !inf->failed) {
+      state->types[lastLocal] = (uint8_t)type;
+    }
+    break;
+  }
+  case OP_COMPOUND_LOCAL: {
+    uint8_t slot = code[offset + 1];
+    if (slot >= state->height) {
+      inf->failed = true;
+      break;
+    }
+    // Arithmetic on a number yields a number, and on a string (only +=
+    // succeeds) a string; anything else raises an error.
+    StaticType old = inf->captured[slot] ? STATIC_ANY
+                                         : (StaticType)state->types[slot];
+    StaticType result =
+        old == STATIC_NUMBER || old == STATIC_STRING ? old : STATIC_ANY;
+    state->types[slot] = (uint8_t)result;
+    pop(inf, state);
+    push(inf, state, (code[offset + 2] & COMPOUND_POSTFIX) ? old : result);
+    break;
+  }
+  case OP_COMPOUND_GLOBAL:
+  case OP_COMPOUND_UPVALUE:
+  case OP_GET_PROPERTY:
+  case OP_GET_FIELD:
+  case OP_UNPACK:
+    pop(inf, state);
+    if (code[offset] == OP_UNPACK) {
+      for (int i = 0; i < code[offset + 1]; i++) {
+        push(inf, state, STATIC_ANY);
+      }
+    } else {
+      push(inf, state, STATIC_ANY);
+    }
+    break;
+  case OP_COMPOUND_PROPERTY:
+    popN(inf, state, 2);
+    push(inf, state, STATIC_ANY);
+    if (code[offset + 2] & COMPOUND_UPDATE) {
+      push(inf, state, STATIC_ANY);
+    }
+    break;
+  case OP_GET_SUPER:
+  case OP_INDEX_SUBSCR:
+  case OP_INDEX_LIST:
+    popN(inf, state, 2);
+    push(inf, state, STATIC_ANY);
+    break;
+  case OP_COMPOUND_SUBSCR:
+    popN(inf, state, 3);
+    push(inf, state, STATIC_ANY);
+    break;
+  case OP_SET_PROPERTY:
+  case OP_SET_FIELD: {
+    StaticType value = pop(inf, state);
+    pop(inf, state);
+    push(inf, state, value);
+    if (code[offset] == OP_SET_FIELD) {
+      push(inf, state, STATIC_ANY); // The receiver, to store back.
+    }
+    break;
+  }
+  case OP_UPDATE_FIELD: {
+    pop(inf, state);
+    StaticType value = pop(inf, state);
+    pop(inf, state);
+    push(inf, state, value);
+    push(inf, state, STATIC_ANY);
+    break;
+  }
+  case OP_STORE_SUBSCR:
+  case OP_STORE_LIST: {
+    StaticType value = pop(inf, state);
+    popN(inf, state, 2);
+    push(inf, state, value);
+    break;
+  }
+  case OP_EQUAL:
+  case OP_IN:
+    popN(inf, state, 2);
+    push(inf, state, STATIC_BOOL);
+    break;
+  case OP_GREATER:
+  case OP_LESS:
+  case OP_GREATER_NUM:
+  case OP_LESS_NUM: {
+    StaticType b = pop(inf, state);
+    StaticType a = pop(inf, state);
+    if (a == STATIC_NUMBER && b == STATIC_NUMBER) {
+      if (code[offset] == OP_GREATER)
+        specialize(inf, offset, rewrite, OP_GREATER_NUM);
+      if (code[offset] == OP_LESS)
+        specialize(inf, offset, rewrite, OP_LESS_NUM);
+    }
+    push(inf, state, STATIC_BOOL);
+    break;
+  }
+  case OP_ADD:
+  case OP_ADD_NUM: {
+    // If either side is known, the other must match or OP_ADD raises.
+    StaticType b = pop(inf, state);
+    StaticType a = pop(inf, state);
+    if (a == STATIC_NUMBER && b == STATIC_NUMBER) {
+      specialize(inf, offset, rewrite, OP_ADD_NUM);
+    }
+    if (a == STATIC_NUMBER || b == STATIC_NUMBER ||
+        code[offset] == OP_ADD_NUM) {
+      push(inf, state, STATIC_NUMBER);
+    } else if (a == STATIC_STRING || b == STATIC_STRING) {
+      push(inf, state, STATIC_STRING);
+    } else {
+      push(inf, state, STATIC_ANY);
+    }
+    break;
+  }
+  case OP_SUBTRACT:
+  case OP_MULTIPLY:
+  case OP_DIVIDE: {
+    StaticType b = pop(inf, state);
+    StaticType a = pop(inf, state);
+    if (a == STATIC_NUMBER && b == STATIC_NUMBER) {
+      specialize(inf, offset, rewrite,
+                 code[offset] == OP_SUBTRACT   ? OP_SUBTRACT_NUM
+                 : code[offset] == OP_MULTIPLY ? OP_MULTIPLY_NUM
+                                               : OP_DIVIDE_NUM);
+    }
+    // A list times a number repeats the list.
+    bool number = code[offset] != OP_MULTIPLY ||
+                  (a == STATIC_NUMBER && b == STATIC_NUMBER);
+    push(inf, state, number ? STATIC_NUMBER : STATIC_ANY);
+    break;
+  }
+  case OP_SUBTRACT_NUM:
+  case OP_MULTIPLY_NUM:
+  case OP_DIVIDE_NUM:
+    popN(inf, state, 2);
+    push(inf, state, STATIC_NUMBER);
+    break;
+  case OP_NOT:
+    pop(inf, state);
+    push(inf, state, STATIC_BOOL);
+    break;
+  case OP_NEGATE:
+  case OP_NEGATE_NUM:
+    if (pop(inf, state) == STATIC_NUMBER) {
+      specialize(inf, offset, rewrite, OP_NEGATE_NUM);
+    }
+    push(inf, state, STATIC_NUMBER);
+    break;
+  case OP_JUMP:
+    if (!rewrite)
+      flowTo(inf, state, next + jumpOperand(chunk, offset));
+    return -1;
+  case OP_JUMP_IF_FALSE:
+    if (!rewrite)
+      flowTo(inf, state, next + jumpOperand(chunk, offset));
+    break;
+  case OP_LOOP:
+    if (!rewrite)
+      flowTo(inf, state, next - jumpOperand(chunk, offset));
+    return -1;
+  case OP_CALL:
+    popN(inf, state, code[offset + 1] + 1);
+    push(inf, state, STATIC_ANY);
+    break;
+  case OP_INVOKE:
+    popN(inf, state, code[offset + 2] + 1);
+    push(inf, state, STATIC_ANY);
+    break;
+  case OP_SUPER_INVOKE:
+    popN(inf, state, code[offset + 2] + 2);
+    push(inf, state, STATIC_ANY);
+    break;
+  case OP_CLOSURE:
+    push(inf, state, STATIC_ANY);
+    break;
+  case OP_BUILD_LIST:
+  case OP_BUILD_TUPLE:
+    popN(inf, state, code[offset + 1]);
+    push(inf, state, STATIC_ANY);
+    break;
+  case OP_RETURN:
+  case OP_THROW:
+    return -1;
+  default:
+    inf->failed = true;
+    return -1;
+  }
+  return next;
+}
+
+static void walkBlock(Inference *inf, int start, bool rewrite) {
+  TypeState state = inf->states[inf->blockIndex[start]];
+  int offset = start;
+  inf->lastLocal = -1;
+  do {
+    offset = step(inf, &state, offset, rewrite);
+  } while (offset != -1 && !inf->failed && offset < inf->chunk->count &&
+           inf->blockIndex[offset] == -1);
+
+  if (offset != -1 && !inf->failed && !rewrite) {
+    flowTo(inf, &state, offset);
+  }
+}
+
+static bool findBlocks(Inference *inf, ObjFunction *function) {
+  Chunk *chunk = inf->chunk;
+  inf->blockIndex[0] = 0;
+  inf->blockCount = 1;
+
+  for (int offset = 0; offset < chunk->count;
+       offset += instructionLength(chunk, offset)) {
+    uint8_t *code = &chunk->code[offset];
+    int target = -1;
+    switch (*code) {
+    case OP_JUMP:
+    case OP_JUMP_IF_FALSE:
+      target = offset + 3 + jumpOperand(chunk, offset);
+      break;
+    case OP_LOOP:
+      target = offset + 3 - jumpOperand(chunk, offset);
+      break;
+    case OP_CLOSURE: {
+      int upvalueCount =
+          AS_FUNCTION(chunk->constants.values[code[1]])->upvalueCount;
+      for (int i = 0; i < upvalueCount; i++) {
+        if (code[2 + 2 * i]) {
+          inf->captured[code[3 + 2 * i]] = true;
+        }
+      }
+      break;
+    }
+    }
+
+    if (target != -1) {
+      if (target < 0 || target >= chunk->count)
+        return false;
+      if (inf->blockIndex[target] == -1) {
+        inf->blockIndex[target] = inf->blockCount++;
+      }
+    }
+  }
+
+  for (int i = 0; i < chunk->handlerCount; i++) {
+    int handler = chunk->handlers[i].handler;
+    if (inf->blockIndex[handler] == -1) {
+      inf->blockIndex[handler] = inf->blockCount++;
+    }
+  }
+
+  // The callee and the parameters are live on entry, of unknown type.
+  inf->states = ALLOCATE(TypeState, inf->blockCount);
+  for (int i = 0; i < inf->blockCount; i++) {
+    inf->states[i].reached = false;
+    inf->states[i].queued = false;
+  }
+  TypeState *entry = &inf->states[0];
+  entry->reached = true;
+  entry->height = function->arity + 1;
+  memset(entry->types, STATIC_ANY, entry->height);
+  return true;
+}
+
+static void seedHandlers(Inference *inf) {
+  // A handler can be entered from anywhere in its try block, so assume
+  // nothing about the surviving locals or the exception.
+  Chunk *chunk = inf->chunk;
+  for (int i = 0; i < chunk->handlerCount; i++) {
+    ExceptionHandler *handler = &chunk->handlers[i];
+    TypeState state;
+    state.height = handler->stackDepth + 1;
+    if (state.height > INFER_STACK_MAX) {
+      inf->failed = true;
+      return;
+    }
+    memset(state.types, STATIC_ANY, state.height);
+    flowTo(inf, &state, handler->handler);
+  }
+}
+
+void inferTypes(ObjFunction *function) {
+  Inference inf;
+  inf.chunk = &function->chunk;
+  inf.states = NULL;
+  inf.worklistCount = 0;
+  inf.failed = false;
+  memset(inf.captured, false, sizeof(inf.captured));
+
+  int count = inf.chunk->count;
+  inf.blockIndex = ALLOCATE(int, count);
+  for (int i = 0; i < count; i++) {
+    inf.blockIndex[i] = -1;
+  }
+
+  if (findBlocks(&inf, function)) {
+    inf.worklist = ALLOCATE(int, inf.blockCount);
+    inf.worklist[inf.worklistCount++] = 0;
+    inf.states[0].queued = true;
+    seedHandlers(&inf);
+
+    while (inf.worklistCount > 0 && !inf.failed) {
+      int start = inf.worklist[--inf.worklistCount];
+      inf.states[inf.blockIndex[start]].queued = false;
+      walkBlock(&inf, start, false);
+    }
+
+    // Rewrite only once every block has settled on its final state.
+    if (!inf.failed) {
+      for (int offset = 0; offset < count; offset++) {
+        int block = inf.blockIndex[offset];
+        if (block != -1 && inf.states[block].reached) {
+          walkBlock(&inf, offset, true);
+        }
+      }
+    }
+
+    FREE_ARRAY(int, inf.worklist, inf.blockCount);
+    FREE_ARRAY(TypeState, inf.states, inf.blockCount);
+  }
+  FREE_ARRAY(int, inf.blockIndex, count);
+}
@@ -0,0 +1,8 @@
+#ifndef clang_infer_h
+#define clang_infer_h
+
+#include "object.h"
+
+void inferTypes(ObjFunction *function);
+
+#endif // clang_infer_h
@@ -1,6 +1,7 @@
 #include "chunk.h"
 #include "common.h"
 #include "debug.h"
+#include "debugger.h"
 #include "vm.h"
 
 #include "memory.h"
@@ -67,8 +68,11 @@ int main(int argc, const char *argv[]) {
     repl();
   } else if (argc == 2) {
     runFile(argv[1]);
+  } else if (argc == 3 && strcmp(argv[1], "--debug") == 0) {
+    enableDebugger();
+    runFile(argv[2]);
   } else {
-    fprintf(stderr, "Usage: lang [path]\n");
+    fprintf(stderr, "Usage: lang [--debug] [path]\n");
     exit(64);
   }
   freeVM();
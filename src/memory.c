@@ -1,4 +1,11 @@
+// mmap and friends are POSIX, which -std=c11 hides by default; mremap is a
+// Linux extension.
+#define _GNU_SOURCE
+
 #include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
 
 #include "chunk.h"
 #include "compiler.h"
@@ -12,23 +19,157 @@
 #endif
 
 #define GC_HEAP_GROW_FACTOR 2
+// How far past the usual threshold the heap may grow while a script has
+// paused collection before one is forced anyway.
+#define GC_PAUSE_CEILING (64 * 1024 * 1024)
+// Trimming walks the allocator's free space, so only small collections skip it.
+#define GC_TRIM_MIN (1024 * 1024)
+
+// Blocks at least this big are mapped straight from the OS instead of coming
+// from the allocator, so freeing one hands its pages back immediately rather
+// than leaving a hole in the malloc heap.
+#define LARGE_OBJECT_THRESHOLD (64 * 1024)
+
+struct LargeBlock {
+  struct LargeBlock *prev;
+  struct LargeBlock *next;
+  size_t mapped;
+};
+
+// Keeps the payload 16-byte aligned.
+#define LARGE_HEADER 32
+
+static size_t pageRound(size_t size) {
+  static size_t pageSize = 0;
+  if (pageSize == 0)
+    pageSize = (size_t)sysconf(_SC_PAGESIZE);
+  return (size + pageSize - 1) / pageSize * pageSize;
+}
+
+static struct LargeBlock *largeHeader(void *pointer) {
+  return (struct LargeBlock *)((char *)pointer - LARGE_HEADER);
+}
+
+static void *allocateLarge(size_t size) {
+  size_t mapped = pageRound(LARGE_HEADER + size);
+  struct LargeBlock *block = mmap(NULL, mapped, PROT_READ | PROT_WRITE,
+                                  MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (block == MAP_FAILED)
+    return NULL;
+
+  block->mapped = mapped;
+  block->prev = NULL;
+  block->next = vm.largeBlocks;
+  if (vm.largeBlocks != NULL)
+    vm.largeBlocks->prev = block;
+  vm.largeBlocks = block;
+  vm.largeBytes += mapped;
+  return (char *)block + LARGE_HEADER;
+}
+
+static void freeLarge(void *pointer) {
+  struct LargeBlock *block = largeHeader(pointer);
+  if (block->prev != NULL) {
+    block->prev->next = block->next;
+  } else {
+    vm.largeBlocks = block->next;
+  }
+  if (block->next != NULL)
+    block->next->prev = block->prev;
+
+  vm.largeBytes -= block->mapped;
+  munmap(block, block->mapped);
+}
+
+static void *resizeLarge(void *pointer, size_t oldSize, size_t newSize) {
+  struct LargeBlock *block = largeHeader(pointer);
+  size_t mapped = pageRound(LARGE_HEADER + newSize);
+  if (mapped == block->mapped)
+    return pointer;
+  if (mapped < block->mapped) {
+    // Shrinking in place; the pages past the new end go back to the OS.
+    munmap((char *)block + mapped, block->mapped - mapped);
+    vm.largeBytes -= block->mapped - mapped;
+    block->mapped = mapped;
+    return pointer;
+  }
+
+#ifdef MREMAP_MAYMOVE
+  (void)oldSize;
+  // Growing lets the kernel move the pages rather than copying them.
+  struct LargeBlock *moved =
+      mremap(block, block->mapped, mapped, MREMAP_MAYMOVE);
+  if (moved == MAP_FAILED)
+    return NULL;
+  if (moved->prev != NULL) {
+    moved->prev->next = moved;
+  } else {
+    vm.largeBlocks = moved;
+  }
+  if (moved->next != NULL)
+    moved->next->prev = moved;
+  vm.largeBytes += mapped - moved->mapped;
+  moved->mapped = mapped;
+  return (char *)moved + LARGE_HEADER;
+#else
+  void *result = allocateLarge(newSize);
+  if (result == NULL)
+    return NULL;
+  memcpy(result, pointer, oldSize);
+  freeLarge(pointer);
+  return result;
+#endif
+}
+
+static void *resizeBlock(void *pointer, size_t oldSize, size_t newSize) {
+  Allocator *allocator = &vm.allocator;
+  bool wasLarge = pointer != NULL && oldSize >= LARGE_OBJECT_THRESHOLD;
+  bool isLarge = newSize >= LARGE_OBJECT_THRESHOLD;
+
+  if (newSize == 0) {
+    if (wasLarge) {
+      freeLarge(pointer);
+    } else {
+      allocator->free(allocator->state, pointer, oldSize);
+    }
+    return NULL;
+  }
+  if (pointer == NULL) {
+    return isLarge ? allocateLarge(newSize)
+                   : allocator->allocate(allocator->state, newSize);
+  }
+  if (wasLarge && isLarge)
+    return resizeLarge(pointer, oldSize, newSize);
+  if (!wasLarge && !isLarge)
+    return allocator->resize(allocator->state, pointer, oldSize, newSize);
+
+  // Crossing the threshold moves the block from one space to the other.
+  void *result = isLarge ? allocateLarge(newSize)
+                         : allocator->allocate(allocator->state, newSize);
+  if (result == NULL)
+    return NULL;
+  memcpy(result, pointer, oldSize < newSize ? oldSize : newSize);
+  resizeBlock(pointer, oldSize, 0);
+  return result;
+}
 
 void *reallocate(void *pointer, size_t oldSize, size_t newSize) {
   vm.bytesAllocated += newSize - oldSize;
   if (newSize > oldSize) {
+    vm.bytesSinceGC += newSize - oldSize;
+    bool paused = vm.gcPauseDepth > 0;
 #ifdef DEBUG_STRESS_GC
-    collectGarbage();
+    if (!paused)
+      collectGarbage();
 #endif
-  }
-  if (vm.bytesAllocated > vm.nextGC) {
-    collectGarbage();
+    if (vm.bytesAllocated > vm.nextGC + (paused ? GC_PAUSE_CEILING : 0)) {
+      collectGarbage();
+    }
   }
 
-  if (newSize == 0) {
-    free(pointer);
+  void *result = resizeBlock(pointer, oldSize, newSize);
+  if (newSize == 0)
     return NULL;
-  }
-  void *result = realloc(pointer, newSize);
   if (result == NULL)
     exit(1);
   return result;
@@ -66,9 +207,22 @@ static void freeObject(Obj *object) {
     FREE(ObjInstance, object);
     break;
   }
+  case OBJ_ITERATOR:
+    FREE(ObjIterator, object);
+    break;
+  case OBJ_PRIORITY_QUEUE: {
+    ObjPriorityQueue *queue = (ObjPriorityQueue *)object;
+    FREE_ARRAY(HeapEntry, queue->entries, queue->capacity);
+    FREE(ObjPriorityQueue, object);
+    break;
+  }
   case OBJ_LIST: {
     ObjList *list = (ObjList *)object;
-    FREE_ARRAY(Value *, list->items, list->count);
+    if (list->kind == LIST_NUMBERS) {
+      FREE_ARRAY(double, list->numbers, list->capacity);
+    } else {
+      FREE_ARRAY(Value, list->items, list->capacity);
+    }
     FREE(ObjList, object);
     break;
   }
@@ -77,14 +231,51 @@ static void freeObject(Obj *object) {
     break;
   case OBJ_STRING: {
     ObjString *string = (ObjString *)object;
+    if (string->index != NULL) {
+      int count = (string->charCount + STRING_INDEX_STRIDE - 1) /
+                  STRING_INDEX_STRIDE;
+      reallocate(string->index, sizeof(StringIndex) + sizeof(int) * count, 0);
+    }
     if (string->ownsChars) {
       reallocate(string, sizeof(ObjString) + string->length + 1, 0);
     }
     break;
   }
+  case OBJ_STRUCT: {
+    ObjStruct *instance = (ObjStruct *)object;
+    reallocate(instance,
+               sizeof(ObjStruct) + sizeof(Value) * instance->fieldCount, 0);
+    break;
+  }
+  case OBJ_STRUCT_TYPE: {
+    ObjStructType *type = (ObjStructType *)object;
+    reallocate(type,
+               sizeof(ObjStructType) + sizeof(ObjString *) * type->fieldCount,
+               0);
+    break;
+  }
+  case OBJ_TUPLE: {
+    ObjTuple *tuple = (ObjTuple *)object;
+    reallocate(tuple, sizeof(ObjTuple) + sizeof(Value) * tuple->count, 0);
+    break;
+  }
   case OBJ_UPVALUE:
     FREE(ObjUpvalue, object);
     break;
+  case OBJ_MAP:
+    FREE(ObjMap, object);
+    break;
+  case OBJ_MAP_NODE: {
+    ObjMapNode *node = (ObjMapNode *)object;
+    reallocate(node, sizeof(ObjMapNode) + sizeof(Value) * node->slotCount, 0);
+    break;
+  }
+  case OBJ_VECTOR:
+    FREE(ObjVector, object);
+    break;
+  case OBJ_VECTOR_NODE:
+    FREE(ObjVectorNode, object);
+    break;
   }
 }
 
@@ -140,6 +331,7 @@ static void blackenObject(Obj *object) {
   case OBJ_CLASS: {
     ObjClass *klass = (ObjClass *)object;
     markObject((Obj *)klass->name);
+    markValue(klass->initializer);
     markTable(&klass->methods);
     break;
   }
@@ -155,6 +347,9 @@ static void blackenObject(Obj *object) {
     ObjFunction *function = (ObjFunction *)object;
     markObject((Obj *)function->name);
     markArray(&function->chunk.constants);
+    for (int i = 0; i < function->chunk.localInfoCount; i++) {
+      markObject((Obj *)function->chunk.localInfos[i].name);
+    }
     break;
   }
   case OBJ_INSTANCE: {
@@ -163,16 +358,78 @@ static void blackenObject(Obj *object) {
     markTable(&instance->fields);
     break;
   }
+  case OBJ_ITERATOR: {
+    ObjIterator *iterator = (ObjIterator *)object;
+    markValue(iterator->source);
+    markValue(iterator->argument);
+    break;
+  }
+  case OBJ_PRIORITY_QUEUE: {
+    ObjPriorityQueue *queue = (ObjPriorityQueue *)object;
+    markValue(queue->comparator);
+    for (int i = 0; i < queue->count; i++) {
+      markValue(queue->entries[i].value);
+    }
+    break;
+  }
   case OBJ_UPVALUE:
     markValue(((ObjUpvalue *)object)->closed);
     break;
+  case OBJ_MAP:
+    markObject((Obj *)((ObjMap *)object)->root);
+    break;
+  case OBJ_MAP_NODE: {
+    ObjMapNode *node = (ObjMapNode *)object;
+    for (int i = 0; i < node->slotCount; i++) {
+      markValue(node->slots[i]);
+    }
+    break;
+  }
+  case OBJ_VECTOR: {
+    ObjVector *vector = (ObjVector *)object;
+    markObject((Obj *)vector->root);
+    markObject((Obj *)vector->tail);
+    break;
+  }
+  case OBJ_VECTOR_NODE: {
+    ObjVectorNode *node = (ObjVectorNode *)object;
+    for (int i = 0; i < TRIE_WIDTH; i++) {
+      markValue(node->slots[i]);
+    }
+    break;
+  }
   case OBJ_LIST: {
     ObjList *list = (ObjList *)object;
+    if (list->kind == LIST_NUMBERS)
+      break;
     for (int i = 0; i < list->count; i++) {
       markValue(list->items[i]);
     }
     break;
   }
+  case OBJ_STRUCT: {
+    ObjStruct *instance = (ObjStruct *)object;
+    markObject((Obj *)instance->type);
+    for (int i = 0; i < instance->fieldCount; i++) {
+      markValue(instance->fields[i]);
+    }
+    break;
+  }
+  case OBJ_STRUCT_TYPE: {
+    ObjStructType *type = (ObjStructType *)object;
+    markObject((Obj *)type->name);
+    for (int i = 0; i < type->fieldCount; i++) {
+      markObject((Obj *)type->fieldNames[i]);
+    }
+    break;
+  }
+  case OBJ_TUPLE: {
+    ObjTuple *tuple = (ObjTuple *)object;
+    for (int i = 0; i < tuple->count; i++) {
+      markValue(tuple->items[i]);
+    }
+    break;
+  }
   case OBJ_NATIVE:
   case OBJ_STRING:
     break;
@@ -194,10 +451,27 @@ static void markRoots() {
   }
 
   markTable(&vm.globals);
+  markTable(&vm.constGlobals);
+  markTable(&vm.globalTypes);
+  markTable(&vm.listMethods);
+  markTable(&vm.stringMethods);
+  markTable(&vm.tupleMethods);
+  markTable(&vm.iteratorMethods);
+  markTable(&vm.priorityQueueMethods);
+  markTable(&vm.vectorMethods);
+  markTable(&vm.mapMethods);
   markCompilerRoots();
   markObject((Obj *)vm.initString);
 }
 
+static void clearBoundMethodCache() {
+  // The cache holds weak references; anything still in use is reachable
+  // some other way and will simply be rebound on its next lookup.
+  for (int i = 0; i < BOUND_METHOD_CACHE_SIZE; i++) {
+    vm.boundMethods[i] = NULL;
+  }
+}
+
 static void traceReferences() {
   while (vm.grayCount > 0) {
     Obj *object = vm.grayStack[--vm.grayCount];
@@ -210,7 +484,8 @@ static void sweep() {
   Obj *object = vm.objects;
   while (object != NULL) {
     if (object->isMarked) {
-      object->isMarked = false;
+      // Strings promoted by the compiler stay here but are never unmarked.
+      object->isMarked = object->isImmortal;
       previous = object;
       object = object->next;
     } else {
@@ -236,9 +511,17 @@ void collectGarbage() {
   markRoots();
   traceReferences();
   tableRemoveWhite(&vm.strings);
+  clearBoundMethodCache();
   sweep();
 
+  // Large blocks were unmapped as they were swept; let the allocator return
+  // whatever the rest of the sweep left empty.
+  if (vm.allocator.trim != NULL && before - vm.bytesAllocated >= GC_TRIM_MIN) {
+    vm.allocator.trim(vm.allocator.state);
+  }
+
   vm.nextGC = vm.bytesAllocated * GC_HEAP_GROW_FACTOR;
+  vm.bytesSinceGC = 0;
 
 #ifdef DEBUG_LOC_GC
   printf("-- gc end\n");
@@ -247,12 +530,67 @@ void collectGarbage() {
 #endif
 }
 
-void freeObjects() {
-  Obj *object = vm.objects;
+void promoteObject(Obj *object) {
+  object->isImmortal = true;
+  object->isMarked = true;
+
+  if (vm.promotedCapacity < vm.promotedCount + 1) {
+    vm.promotedCapacity = GROW_CAPACITY(vm.promotedCapacity);
+    vm.promoted =
+        (Obj **)realloc(vm.promoted, sizeof(Obj *) * vm.promotedCapacity);
+
+    if (vm.promoted == NULL)
+      exit(1);
+  }
+
+  vm.promoted[vm.promotedCount++] = object;
+}
+
+// Returns everything made immortal since newest headed the immortal list to
+// the collected heap, along with the objects promoted in place meanwhile.
+// Nothing is marked between collections, so their flags are just cleared.
+void releaseImmortalObjects(Obj *newest) {
+  if (vm.immortalObjects != newest) {
+    Obj *last = vm.immortalObjects;
+    for (;;) {
+      last->isImmortal = false;
+      last->isMarked = false;
+      if (last->next == newest)
+        break;
+      last = last->next;
+    }
+    last->next = vm.objects;
+    vm.objects = vm.immortalObjects;
+    vm.immortalObjects = newest;
+  }
+
+  for (int i = 0; i < vm.promotedCount; i++) {
+    vm.promoted[i]->isImmortal = false;
+    vm.promoted[i]->isMarked = false;
+  }
+  vm.promotedCount = 0;
+}
+
+static void freeObjectList(Obj *object) {
   while (object != NULL) {
     Obj *next = object->next;
     freeObject(object);
     object = next;
   }
+}
+
+void freeObjects() {
+  if (vm.allocator.reset != NULL) {
+    vm.allocator.reset(vm.allocator.state);
+    while (vm.largeBlocks != NULL) {
+      freeLarge((char *)vm.largeBlocks + LARGE_HEADER);
+    }
+  } else {
+    freeObjectList(vm.objects);
+    freeObjectList(vm.immortalObjects);
+  }
+  vm.objects = NULL;
+  vm.immortalObjects = NULL;
   free(vm.grayStack);
+  free(vm.promoted);
 }
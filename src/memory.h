@@ -22,6 +22,8 @@ void *reallocate(void *pointer, size_t oldSize, size_t newSize);
 void markObject(Obj *object);
 void markValue(Value value);
 void collectGarbage();
+void promoteObject(Obj *object);
+void releaseImmortalObjects(Obj *newest);
 void freeObjects();
 
 #endif // clang_memory_h
@@ -1,12 +1,16 @@
 #include "object.h"
 #include "chunk.h"
 #include "memory.h"
+#include "persistent.h"
 #include "table.h"
 #include "value.h"
 #include "vm.h"
 
 #include <stdio.h>
 #include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #define ALLOCATE_OBJ(type, objectType)                                         \
   (type *)allocateObject(sizeof(type), objectType)
@@ -14,10 +18,16 @@
 static Obj *allocateObject(size_t size, ObjType type) {
   Obj *object = (Obj *)reallocate(NULL, 0, size);
   object->type = type;
-  object->isMarked = false;
-
-  object->next = vm.objects;
-  vm.objects = object;
+  object->isImmortal = vm.allocatingImmortal;
+  object->isMarked = object->isImmortal;
+
+  if (object->isImmortal) {
+    object->next = vm.immortalObjects;
+    vm.immortalObjects = object;
+  } else {
+    object->next = vm.objects;
+    vm.objects = object;
+  }
 
 #ifdef DEBUG_LOG_GC
   printf("%p allocate %zu for %d\n", (void *)object, size, type);
@@ -36,6 +46,8 @@ ObjBoundMethod *newBoundMethod(Value receiver, ObjClosure *method) {
 ObjClass *newClass(ObjString *name) {
   ObjClass *klass = ALLOCATE_OBJ(ObjClass, OBJ_CLASS);
   klass->name = name;
+  klass->initializer = NIL_VAL;
+  klass->fieldCount = 0;
   initTable(&klass->methods);
   return klass;
 }
@@ -65,6 +77,12 @@ ObjInstance *newInstance(ObjClass *klass) {
   ObjInstance *instance = ALLOCATE_OBJ(ObjInstance, OBJ_INSTANCE);
   instance->klass = klass;
   initTable(&instance->fields);
+
+  // Size the fields table for the shape earlier instances ended up with so
+  // init doesn't regrow it one field at a time.
+  push(OBJ_VAL(instance));
+  tableReserve(&instance->fields, klass->fieldCount);
+  pop();
   return instance;
 }
 
@@ -75,6 +93,44 @@ ObjNative *newNative(NativeFn function, int arity) {
   return native;
 }
 
+// Bytes in the character starting at start: its lead byte and any
+// continuation bytes after it. Malformed sequences still step forward.
+static int charWidth(const char *start, const char *end) {
+  int width = 1;
+  while (width < 4 && start + width < end &&
+         ((uint8_t)start[width] & 0xC0) == 0x80) {
+    width++;
+  }
+  return width;
+}
+
+static void measureString(ObjString *string) {
+  // Checks eight bytes at a time for any with the high bit set.
+  const char *chars = string->chars;
+  int length = string->length;
+  int i = 0;
+  bool ascii = true;
+  for (; ascii && i + 8 <= length; i += 8) {
+    uint64_t word;
+    memcpy(&word, chars + i, sizeof(word));
+    ascii = (word & 0x8080808080808080ull) == 0;
+  }
+  for (; ascii && i < length; i++) {
+    ascii = ((uint8_t)chars[i] & 0x80) == 0;
+  }
+
+  string->isAscii = ascii;
+  string->index = NULL;
+  string->charCount = 0;
+  if (ascii) {
+    string->charCount = length;
+    return;
+  }
+  for (const char *c = chars; c < chars + length; c += charWidth(c, chars + length)) {
+    string->charCount++;
+  }
+}
+
 static ObjString *allocateString(const char *chars, int length, uint32_t hash,
                                  bool ownsChars) {
   // Allocate memory for ObjString and flexible array
@@ -89,6 +145,7 @@ static ObjString *allocateString(const char *chars, int length, uint32_t hash,
   // Copy characters into the flexible array (source remains const)
   memcpy(string->chars, chars, length);
   string->chars[length] = '\0';
+  measureString(string);
 
   // Intern the string
   push(OBJ_VAL(string));
@@ -111,6 +168,11 @@ static ObjString *makeString(const char *chars, int length, uint32_t hash,
   // Check if the string already exists in the intern table
   ObjString *interned = tableFindString(&vm.strings, chars, length, hash);
   if (interned != NULL) {
+    // Code being compiled may reuse a string made earlier at runtime. It
+    // now has to live as long as the code, so promote it in place.
+    if (vm.allocatingImmortal && !interned->obj.isImmortal) {
+      promoteObject((Obj *)interned);
+    }
     // If found, return the existing interned string
     return interned;
   }
@@ -126,9 +188,12 @@ static ObjString *makeString(const char *chars, int length, uint32_t hash,
   // Copy the characters into the flexible array
   memcpy(string->chars, chars, length);
   string->chars[length] = '\0';
+  measureString(string);
 
   // Add the string to the intern table
+  push(OBJ_VAL(string));
   tableSet(&vm.strings, string, NIL_VAL);
+  pop();
 
   return string;
 }
@@ -145,6 +210,151 @@ ObjString *copyString(const char *chars, int length) {
   return makeString(chars, length, hash, true); // Interned and owns its data
 }
 
+static StringIndex *buildStringIndex(ObjString *string) {
+  // Expects string is already trackable by GC i.e. on stack.
+  int count = (string->charCount + STRING_INDEX_STRIDE - 1) / STRING_INDEX_STRIDE;
+  StringIndex *index = (StringIndex *)reallocate(
+      NULL, 0, sizeof(StringIndex) + sizeof(int) * count);
+  const char *end = string->chars + string->length;
+  const char *c = string->chars;
+  for (int i = 0; i < string->charCount; i++) {
+    if (i % STRING_INDEX_STRIDE == 0) {
+      index->breadcrumbs[i / STRING_INDEX_STRIDE] = (int)(c - string->chars);
+    }
+    c += charWidth(c, end);
+  }
+  index->cursorChar = 0;
+  index->cursorByte = 0;
+  return index;
+}
+
+// Byte offset of a character, walking at most a stride from the cursor or
+// the breadcrumb before it.
+static int charOffset(ObjString *string, int charIndex) {
+  if (string->isAscii)
+    return charIndex;
+  if (string->index == NULL) {
+    string->index = buildStringIndex(string);
+  }
+
+  StringIndex *index = string->index;
+  int current = charIndex - charIndex % STRING_INDEX_STRIDE;
+  int offset = index->breadcrumbs[current / STRING_INDEX_STRIDE];
+  if (index->cursorChar <= charIndex && index->cursorChar > current) {
+    current = index->cursorChar;
+    offset = index->cursorByte;
+  }
+  const char *end = string->chars + string->length;
+  for (; current < charIndex; current++) {
+    offset += charWidth(string->chars + offset, end);
+  }
+  index->cursorChar = charIndex;
+  index->cursorByte = offset;
+  return offset;
+}
+
+ObjString *stringCharAt(ObjString *string, int index) {
+  // Index is assumed to be valid.
+  // Expects string is already trackable by GC i.e. on stack.
+  int offset = charOffset(string, index);
+  return nextStringChar(string, &offset);
+}
+
+ObjString *nextStringChar(ObjString *string, int *offset) {
+  // Copies out the character at a byte offset and moves past it.
+  const char *start = string->chars + *offset;
+  int width = string->isAscii
+                  ? 1
+                  : charWidth(start, string->chars + string->length);
+  *offset += width;
+  return copyString(start, width);
+}
+
+ObjPriorityQueue *newPriorityQueue(Value comparator) {
+  ObjPriorityQueue *queue = ALLOCATE_OBJ(ObjPriorityQueue, OBJ_PRIORITY_QUEUE);
+  queue->comparator = comparator;
+  queue->isComparing = false;
+  queue->count = 0;
+  queue->capacity = 0;
+  queue->entries = NULL;
+  return queue;
+}
+
+ObjTuple *newTuple(Value *items, int count) {
+  // Expects items are already trackable by GC i.e. on stack.
+  ObjTuple *tuple = (ObjTuple *)allocateObject(
+      sizeof(ObjTuple) + sizeof(Value) * count, OBJ_TUPLE);
+  tuple->count = count;
+
+  // Tuples are immutable, so the structural hash can be computed once.
+  uint32_t hash = 2166136261u;
+  for (int i = 0; i < count; i++) {
+    tuple->items[i] = items[i];
+    hash ^= hashValue(items[i]);
+    hash *= 16777619;
+  }
+  tuple->hash = hash;
+  return tuple;
+}
+
+ObjStructType *newStructType(ObjString *name, int fieldCount) {
+  ObjStructType *type = (ObjStructType *)allocateObject(
+      sizeof(ObjStructType) + sizeof(ObjString *) * fieldCount,
+      OBJ_STRUCT_TYPE);
+  type->name = name;
+  type->fieldCount = fieldCount;
+  for (int i = 0; i < fieldCount; i++) {
+    type->fieldNames[i] = NULL;
+  }
+  return type;
+}
+
+static ObjStruct *allocateStruct(ObjStructType *type, Value *fields) {
+  ObjStruct *object = (ObjStruct *)allocateObject(
+      sizeof(ObjStruct) + sizeof(Value) * type->fieldCount, OBJ_STRUCT);
+  object->type = type;
+  object->fieldCount = type->fieldCount;
+  for (int i = 0; i < type->fieldCount; i++) {
+    object->fields[i] = fields[i];
+  }
+  return object;
+}
+
+static void hashStruct(ObjStruct *object) {
+  // Structs are immutable, so like tuples they hash once, structurally.
+  uint32_t hash = 2166136261u ^ object->type->name->hash;
+  for (int i = 0; i < object->fieldCount; i++) {
+    hash ^= hashValue(object->fields[i]);
+    hash *= 16777619;
+  }
+  object->hash = hash;
+}
+
+ObjStruct *newStruct(ObjStructType *type, Value *fields) {
+  // Expects type and fields are already trackable by GC i.e. on stack.
+  ObjStruct *object = allocateStruct(type, fields);
+  hashStruct(object);
+  return object;
+}
+
+ObjStruct *structWithField(ObjStruct *object, int index, Value value) {
+  // Expects object and value are already trackable by GC i.e. on stack.
+  ObjStruct *copy = allocateStruct(object->type, object->fields);
+  copy->fields[index] = value;
+  hashStruct(copy);
+  return copy;
+}
+
+int structFieldIndex(ObjStructType *type, ObjString *name) {
+  // Field names are interned and structs are small, so a pointer scan beats
+  // hashing.
+  for (int i = 0; i < type->fieldCount; i++) {
+    if (type->fieldNames[i] == name)
+      return i;
+  }
+  return -1;
+}
+
 ObjUpvalue *newUpvalue(Value *slot) {
   ObjUpvalue *upvalue = ALLOCATE_OBJ(ObjUpvalue, OBJ_UPVALUE);
   upvalue->closed = NIL_VAL;
@@ -153,6 +363,26 @@ ObjUpvalue *newUpvalue(Value *slot) {
   return upvalue;
 }
 
+ObjVector *newVector(ObjVectorNode *root, ObjVectorNode *tail, int count,
+                     int shift, uint32_t edit) {
+  ObjVector *vector = ALLOCATE_OBJ(ObjVector, OBJ_VECTOR);
+  vector->root = root;
+  vector->tail = tail;
+  vector->count = count;
+  vector->shift = shift;
+  vector->edit = edit;
+  return vector;
+}
+
+ObjVectorNode *newVectorNode(uint32_t edit) {
+  ObjVectorNode *node = ALLOCATE_OBJ(ObjVectorNode, OBJ_VECTOR_NODE);
+  node->edit = edit;
+  for (int i = 0; i < TRIE_WIDTH; i++) {
+    node->slots[i] = NIL_VAL;
+  }
+  return node;
+}
+
 static void printFunction(ObjFunction *function) {
   if (function->name == NULL) {
     printf("<script>");
@@ -161,25 +391,89 @@ static void printFunction(ObjFunction *function) {
   printf("<fn %s>", function->name->chars);
 }
 
+ObjMap *newMap(ObjMapNode *root, int count, uint32_t edit) {
+  ObjMap *map = ALLOCATE_OBJ(ObjMap, OBJ_MAP);
+  map->root = root;
+  map->count = count;
+  map->edit = edit;
+  return map;
+}
+
+ObjMapNode *newMapNode(uint32_t edit, uint32_t dataMap, uint32_t nodeMap,
+                       int slotCount) {
+  ObjMapNode *node = (ObjMapNode *)allocateObject(
+      sizeof(ObjMapNode) + sizeof(Value) * slotCount, OBJ_MAP_NODE);
+  node->edit = edit;
+  node->dataMap = dataMap;
+  node->nodeMap = nodeMap;
+  node->slotCount = slotCount;
+  for (int i = 0; i < slotCount; i++) {
+    node->slots[i] = NIL_VAL;
+  }
+  return node;
+}
+
+ObjIterator *newIterator(IteratorKind kind, Value source, Value argument) {
+  ObjIterator *iterator = ALLOCATE_OBJ(ObjIterator, OBJ_ITERATOR);
+  iterator->kind = kind;
+  iterator->source = source;
+  iterator->argument = argument;
+  iterator->position = 0;
+  iterator->limit = 0;
+  iterator->offset = 0;
+  return iterator;
+}
+
 ObjList *newList() {
   ObjList *list = ALLOCATE_OBJ(ObjList, OBJ_LIST);
-  list->items = NULL;
+  list->kind = LIST_NUMBERS;
+  list->numbers = NULL;
   list->count = 0;
   list->capacity = 0;
   return list;
 }
 
+static void generalizeList(ObjList *list) {
+  // Box every number into a tagged value array of the same capacity.
+  // Expects list is already trackable by GC i.e. on stack.
+  Value *items = ALLOCATE(Value, list->capacity);
+  for (int i = 0; i < list->count; i++) {
+    items[i] = NUMBER_VAL(list->numbers[i]);
+  }
+  FREE_ARRAY(double, list->numbers, list->capacity);
+  list->items = items;
+  list->kind = LIST_VALUES;
+}
+
+static void reserveListItem(ObjList *list, Value value) {
+  // Makes room for one more item and widens the list if value doesn't fit
+  // its current kind.
+  if (list->kind == LIST_NUMBERS && !IS_NUMBER(value)) {
+    generalizeList(list);
+  }
+  if (list->capacity < list->count + 1) {
+    int oldCapacity = list->capacity;
+    list->capacity = GROW_CAPACITY(oldCapacity);
+    if (list->kind == LIST_NUMBERS) {
+      list->numbers =
+          GROW_ARRAY(double, list->numbers, oldCapacity, list->capacity);
+    } else {
+      list->items = GROW_ARRAY(Value, list->items, oldCapacity, list->capacity);
+    }
+  }
+}
+
 void appendToList(ObjList *list, Value value) {
   // Add an item to the end of a list.
   // Length of list will grow by 1 from users perspective.
   // Capacity of internal representation may or may not increase.
   // Expects list and value are already trackable by GC i.e. on stack.
-  if (list->capacity < list->count + 1) {
-    int oldCapacity = list->capacity;
-    list->capacity = GROW_CAPACITY(oldCapacity);
-    list->items = GROW_ARRAY(Value, list->items, oldCapacity, list->capacity);
+  reserveListItem(list, value);
+  if (list->kind == LIST_NUMBERS) {
+    list->numbers[list->count] = AS_NUMBER(value);
+  } else {
+    list->items[list->count] = value;
   }
-  list->items[list->count] = value;
   list->count++;
   return;
 }
@@ -187,17 +481,51 @@ void appendToList(ObjList *list, Value value) {
 void storeToList(ObjList *list, int index, Value value) {
   // Change the value stored at a particular index in a list.
   // Index is assumed to be valid.
+  // Expects list and value are already trackable by GC i.e. on stack.
+  if (list->kind == LIST_NUMBERS) {
+    if (IS_NUMBER(value)) {
+      list->numbers[index] = AS_NUMBER(value);
+      return;
+    }
+    generalizeList(list);
+  }
   list->items[index] = value;
 }
 
 Value indexFromList(ObjList *list, int index) {
   // Index is assumed to be valid.
+  if (list->kind == LIST_NUMBERS)
+    return NUMBER_VAL(list->numbers[index]);
   return list->items[index];
 }
 
+void insertToList(ObjList *list, int index, Value value) {
+  // Insert a value before the given index, shifting later items up by one.
+  // Index is assumed to be in the range [0, count].
+  // Expects list and value are already trackable by GC i.e. on stack.
+  reserveListItem(list, value);
+  if (list->kind == LIST_NUMBERS) {
+    memmove(&list->numbers[index + 1], &list->numbers[index],
+            sizeof(double) * (list->count - index));
+    list->numbers[index] = AS_NUMBER(value);
+  } else {
+    for (int i = list->count; i > index; i--) {
+      list->items[i] = list->items[i - 1];
+    }
+    list->items[index] = value;
+  }
+  list->count++;
+}
+
 void deleteFromList(ObjList *list, int index) {
   // TODO reduce capacity if count to capacity ratio gets too low
   // Index is assumed to be valid
+  if (list->kind == LIST_NUMBERS) {
+    memmove(&list->numbers[index], &list->numbers[index + 1],
+            sizeof(double) * (list->count - index - 1));
+    list->count--;
+    return;
+  }
   for (int i = index; i < list->count - 1; i++) {
     list->items[i] = list->items[i + 1];
   }
@@ -212,18 +540,188 @@ bool isValidListIndex(ObjList *list, int index) {
   return true;
 }
 
+// Membership scans compare a block of items with SIMD instructions and
+// branch once per block, then finish the tail one item at a time.
+#define SCAN_BLOCK 8
+
+static bool numbersContain(const double *numbers, int count, double needle) {
+  int i = 0;
+#ifdef __SSE2__
+  __m128d target = _mm_set1_pd(needle);
+  for (; i + SCAN_BLOCK <= count; i += SCAN_BLOCK) {
+    __m128d found = _mm_setzero_pd();
+    for (int j = 0; j < SCAN_BLOCK; j += 2) {
+      found = _mm_or_pd(found,
+                        _mm_cmpeq_pd(_mm_loadu_pd(numbers + i + j), target));
+    }
+    if (_mm_movemask_pd(found))
+      return true;
+  }
+#endif
+  for (; i < count; i++) {
+    if (numbers[i] == needle)
+      return true;
+  }
+  return false;
+}
+
+static bool valuesContain(const Value *items, int count, Value needle) {
+  int i = 0;
+#ifdef __SSE2__
+  // Objects other than tuples, structs and bound methods (strings are
+  // interned) are equal exactly when their bits are, and so are numbers
+  // other than zero and NaN. Those needles are compared against a whole Value
+  // per instruction, with the padding between the type tag and the payload
+  // masked off.
+  _Static_assert(sizeof(Value) == 16, "Value is a tag and an 8-byte payload.");
+  bool bitwise = IS_NUMBER(needle)
+                     ? AS_NUMBER(needle) == AS_NUMBER(needle) &&
+                           AS_NUMBER(needle) != 0
+                     : IS_OBJ(needle) && !IS_TUPLE(needle) &&
+                           !IS_STRUCT(needle) &&
+                           !IS_BOUND_METHOD(needle);
+  if (bitwise) {
+    __m128i mask = _mm_set_epi32(-1, -1, 0, -1);
+    __m128i target =
+        _mm_and_si128(_mm_loadu_si128((const __m128i *)&needle), mask);
+    for (; i + SCAN_BLOCK <= count; i += SCAN_BLOCK) {
+      __m128i found = _mm_setzero_si128();
+      for (int j = 0; j < SCAN_BLOCK; j++) {
+        __m128i item = _mm_and_si128(
+            _mm_loadu_si128((const __m128i *)&items[i + j]), mask);
+        // An item matches only if all four of its lanes do.
+        __m128i equal = _mm_cmpeq_epi32(item, target);
+        equal = _mm_and_si128(equal, _mm_shuffle_epi32(equal, 0xB1));
+        equal = _mm_and_si128(equal, _mm_shuffle_epi32(equal, 0x4E));
+        found = _mm_or_si128(found, equal);
+      }
+      if (_mm_movemask_epi8(found))
+        return true;
+    }
+  }
+#endif
+  for (; i < count; i++) {
+    if (valuesEqual(items[i], needle))
+      return true;
+  }
+  return false;
+}
+
+bool listContains(ObjList *list, Value value) {
+  if (list->kind == LIST_NUMBERS) {
+    return IS_NUMBER(value) &&
+           numbersContain(list->numbers, list->count, AS_NUMBER(value));
+  }
+  return valuesContain(list->items, list->count, value);
+}
+
+bool tupleContains(ObjTuple *tuple, Value value) {
+  return valuesContain(tuple->items, tuple->count, value);
+}
+
+static void copyItems(Value *items, ObjList *list) {
+  if (list->kind == LIST_VALUES) {
+    memcpy(items, list->items, sizeof(Value) * list->count);
+    return;
+  }
+  for (int i = 0; i < list->count; i++) {
+    items[i] = NUMBER_VAL(list->numbers[i]);
+  }
+}
+
+// Wraps an already filled array in a new list. The array isn't an object,
+// so it needs no protection from a collection while the list is allocated.
+static ObjList *listWithItems(ListKind kind, void *items, int count) {
+  ObjList *list = newList();
+  list->kind = kind;
+  if (kind == LIST_NUMBERS) {
+    list->numbers = (double *)items;
+  } else {
+    list->items = (Value *)items;
+  }
+  list->count = count;
+  list->capacity = count;
+  return list;
+}
+
+ObjList *concatenateLists(ObjList *a, ObjList *b) {
+  // Expects a and b are already trackable by GC i.e. on stack.
+  int count = a->count + b->count;
+  if (count == 0)
+    return newList();
+
+  if (a->kind == LIST_NUMBERS && b->kind == LIST_NUMBERS) {
+    double *numbers = ALLOCATE(double, count);
+    memcpy(numbers, a->numbers, sizeof(double) * a->count);
+    memcpy(numbers + a->count, b->numbers, sizeof(double) * b->count);
+    return listWithItems(LIST_NUMBERS, numbers, count);
+  }
+  Value *items = ALLOCATE(Value, count);
+  copyItems(items, a);
+  copyItems(items + a->count, b);
+  return listWithItems(LIST_VALUES, items, count);
+}
+
+ObjList *repeatList(ObjList *list, int times) {
+  // Expects list is already trackable by GC i.e. on stack, and that the
+  // result's length fits in an int.
+  int count = list->count * times;
+  if (count == 0)
+    return newList();
+
+  size_t itemSize = list->kind == LIST_NUMBERS ? sizeof(double) : sizeof(Value);
+  size_t size = itemSize * list->count;
+  char *items = ALLOCATE(char, itemSize * count);
+  memcpy(items, list->kind == LIST_NUMBERS ? (void *)list->numbers
+                                           : (void *)list->items,
+         size);
+  // Each copy doubles the filled prefix.
+  size_t filled = size;
+  size_t total = itemSize * count;
+  while (filled < total) {
+    size_t chunk = filled < total - filled ? filled : total - filled;
+    memcpy(items + filled, items, chunk);
+    filled += chunk;
+  }
+  return listWithItems(list->kind, items, count);
+}
+
 static void printList(ObjList *list) {
   printf("[");
   for (int i = 0; i < list->count - 1; i++) {
-    printValue(list->items[i]);
+    printValue(indexFromList(list, i));
     printf(", ");
   }
   if (list->count != 0) {
-    printValue(list->items[list->count - 1]);
+    printValue(indexFromList(list, list->count - 1));
   }
   printf("]");
 }
 
+static void printStruct(ObjStruct *object) {
+  printf("%s(", object->type->name->chars);
+  for (int i = 0; i < object->fieldCount; i++) {
+    printValue(object->fields[i]);
+    if (i < object->fieldCount - 1) {
+      printf(", ");
+    }
+  }
+  printf(")");
+}
+
+static void printTuple(ObjTuple *tuple) {
+  printf("(");
+  for (int i = 0; i < tuple->count; i++) {
+    printValue(tuple->items[i]);
+    if (i < tuple->count - 1) {
+      printf(", ");
+    } else if (tuple->count == 1) {
+      printf(",");
+    }
+  }
+  printf(")");
+}
+
 void printObject(Value value) {
   switch (OBJ_TYPE(value)) {
   case OBJ_BOUND_METHOD:
@@ -241,17 +739,44 @@ void printObject(Value value) {
   case OBJ_INSTANCE:
     printf("%s instance", AS_INSTANCE(value)->klass->name->chars);
     break;
+  case OBJ_ITERATOR:
+    printf("<iterator>");
+    break;
   case OBJ_LIST:
     printList(AS_LIST(value));
     break;
   case OBJ_NATIVE:
     printf("<native fn>");
     break;
+  case OBJ_PRIORITY_QUEUE:
+    printf("<priority queue>");
+    break;
   case OBJ_STRING:
     printf("%s", AS_CSTRING(value));
     break;
+  case OBJ_STRUCT:
+    printStruct(AS_STRUCT(value));
+    break;
+  case OBJ_STRUCT_TYPE:
+    printf("<struct %s>", AS_STRUCT_TYPE(value)->name->chars);
+    break;
+  case OBJ_TUPLE:
+    printTuple(AS_TUPLE(value));
+    break;
   case OBJ_UPVALUE:
     printf("upvalue");
     break;
+  case OBJ_MAP:
+    printMap(AS_MAP(value));
+    break;
+  case OBJ_MAP_NODE:
+    printf("<map node>");
+    break;
+  case OBJ_VECTOR:
+    printVector(AS_VECTOR(value));
+    break;
+  case OBJ_VECTOR_NODE:
+    printf("<vector node>");
+    break;
   }
 }
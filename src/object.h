@@ -13,19 +13,33 @@
 #define IS_CLOSURE(value) isObjType(value, OBJ_CLOSURE)
 #define IS_FUNCTION(value) isObjType(value, OBJ_FUNCTION)
 #define IS_INSTANCE(value) isObjType(value, OBJ_INSTANCE)
+#define IS_ITERATOR(value) isObjType(value, OBJ_ITERATOR)
 #define IS_LIST(value) isObjType(value, OBJ_LIST)
+#define IS_MAP(value) isObjType(value, OBJ_MAP)
 #define IS_NATIVE(value) isObjType(value, OBJ_NATIVE)
+#define IS_PRIORITY_QUEUE(value) isObjType(value, OBJ_PRIORITY_QUEUE)
 #define IS_STRING(value) isObjType(value, OBJ_STRING)
+#define IS_STRUCT(value) isObjType(value, OBJ_STRUCT)
+#define IS_STRUCT_TYPE(value) isObjType(value, OBJ_STRUCT_TYPE)
+#define IS_TUPLE(value) isObjType(value, OBJ_TUPLE)
+#define IS_VECTOR(value) isObjType(value, OBJ_VECTOR)
 
 #define AS_BOUND_METHOD(value) ((ObjBoundMethod *)AS_OBJ(value))
 #define AS_CLASS(value) ((ObjClass *)AS_OBJ(value))
 #define AS_CLOSURE(value) ((ObjClosure *)AS_OBJ(value))
 #define AS_FUNCTION(value) ((ObjFunction *)AS_OBJ(value))
 #define AS_INSTANCE(value) ((ObjInstance *)AS_OBJ(value))
+#define AS_ITERATOR(value) ((ObjIterator *)AS_OBJ(value))
 #define AS_LIST(value) ((ObjList *)AS_OBJ(value))
+#define AS_MAP(value) ((ObjMap *)AS_OBJ(value))
 #define AS_NATIVE(value) (((ObjNative *)AS_OBJ(value)))
+#define AS_PRIORITY_QUEUE(value) ((ObjPriorityQueue *)AS_OBJ(value))
 #define AS_STRING(value) ((ObjString *)AS_OBJ(value))
 #define AS_CSTRING(value) (((ObjString *)AS_OBJ(value))->chars)
+#define AS_STRUCT(value) ((ObjStruct *)AS_OBJ(value))
+#define AS_STRUCT_TYPE(value) ((ObjStructType *)AS_OBJ(value))
+#define AS_TUPLE(value) ((ObjTuple *)AS_OBJ(value))
+#define AS_VECTOR(value) ((ObjVector *)AS_OBJ(value))
 
 typedef enum {
   OBJ_BOUND_METHOD,
@@ -33,15 +47,27 @@ typedef enum {
   OBJ_CLOSURE,
   OBJ_FUNCTION,
   OBJ_INSTANCE,
+  OBJ_ITERATOR,
   OBJ_LIST,
+  OBJ_MAP,
+  OBJ_MAP_NODE,
   OBJ_NATIVE,
+  OBJ_PRIORITY_QUEUE,
   OBJ_STRING,
-  OBJ_UPVALUE
+  OBJ_STRUCT,
+  OBJ_STRUCT_TYPE,
+  OBJ_TUPLE,
+  OBJ_UPVALUE,
+  OBJ_VECTOR,
+  OBJ_VECTOR_NODE
 } ObjType;
 
 struct Obj {
   ObjType type;
   bool isMarked;
+  // Set for objects that live as long as the VM. They are never swept and
+  // stay marked, so tracing stops at them.
+  bool isImmortal;
   struct Obj *next;
 };
 
@@ -53,13 +79,65 @@ typedef struct {
   ObjString *name;
 } ObjFunction;
 
+// Lists start out holding only numbers, stored unboxed, and switch to
+// tagged values for good the first time anything else is stored in them.
+typedef enum {
+  LIST_NUMBERS,
+  LIST_VALUES,
+} ListKind;
+
 typedef struct {
   Obj obj;
+  ListKind kind;
   int count;
   int capacity;
-  Value *items;
+  union {
+    double *numbers; // LIST_NUMBERS
+    Value *items;    // LIST_VALUES
+  };
 } ObjList;
 
+// One stage of a lazy pipeline such as xs.map(f).filter(g).take(10). Stages
+// are pulled one element at a time from the end of the chain, so nothing
+// runs until a terminal like toList() asks for elements, and a take() that
+// is satisfied stops everything upstream of it.
+typedef enum {
+  ITER_SEQUENCE, // Walks the list or tuple in source.
+  ITER_MAP,
+  ITER_FILTER,
+  ITER_TAKE,
+  ITER_ZIP,
+  ITER_ENUMERATE,
+} IteratorKind;
+
+typedef struct {
+  Obj obj;
+  IteratorKind kind;
+  Value source;   // The upstream stage, or the sequence being walked.
+  Value argument; // The function for map and filter, the other side of zip.
+  int position;   // Elements produced so far.
+  int limit;      // For take.
+  int offset;     // Byte offset of the next character when walking a string.
+} ObjIterator;
+
+// A binary min-heap stored in one array. Entries come out in order of
+// their numeric priority, or of a comparator closure when one is given, in
+// which case priorities are unused.
+typedef struct {
+  double priority;
+  Value value;
+} HeapEntry;
+
+typedef struct {
+  Obj obj;
+  Value comparator; // nil to order by priority.
+  // Set while the comparator runs, so it can't reshape the heap under us.
+  bool isComparing;
+  int count;
+  int capacity;
+  HeapEntry *entries;
+} ObjPriorityQueue;
+
 typedef struct {
   bool isError;
   Value result;
@@ -73,14 +151,108 @@ typedef struct {
   NativeFn function;
 } ObjNative;
 
+// Strings are UTF-8 and index by character. For pure ASCII strings a
+// character is a byte; others build a StringIndex the first time they are
+// indexed.
+#define STRING_INDEX_STRIDE 32
+
+typedef struct {
+  // The last character looked up, so walking a string in order never scans
+  // back from a breadcrumb.
+  int cursorChar;
+  int cursorByte;
+  // Byte offset of every STRING_INDEX_STRIDE'th character.
+  int breadcrumbs[];
+} StringIndex;
+
 struct ObjString {
   Obj obj;
-  int length;
+  int length; // In bytes.
   bool ownsChars;
+  bool isAscii;
   uint32_t hash;
+  int charCount;
+  StringIndex *index;
   char chars[];
 };
 
+typedef struct {
+  Obj obj;
+  int count;
+  uint32_t hash;
+  Value items[];
+} ObjTuple;
+
+// A value-struct type: a fixed, ordered set of fields declared with 'struct'.
+typedef struct {
+  Obj obj;
+  ObjString *name;
+  int fieldCount;
+  ObjString *fieldNames[];
+} ObjStructType;
+
+// Fields live inline after the header, at the offsets given by the type.
+// Structs are values: one never changes once made, and assigning a field
+// makes an updated copy that replaces the original in its variable. Sharing
+// a struct is then indistinguishable from copying it.
+typedef struct {
+  Obj obj;
+  ObjStructType *type;
+  int fieldCount; // Copied from type, which may be swept first.
+  uint32_t hash;
+  Value fields[];
+} ObjStruct;
+
+// Persistent collections never change once made; updates return a new
+// version that shares every untouched node with the old one. A transient
+// is a version that may change in place: nodes stamped with its edit token
+// were made by it alone, so it updates them without copying. Edit token 0
+// marks a persistent version.
+
+// Branches of both tries take five bits of the index or hash at a time.
+#define TRIE_BITS 5
+#define TRIE_WIDTH (1 << TRIE_BITS)
+#define TRIE_MASK (TRIE_WIDTH - 1)
+
+// Values in a leaf, child nodes in a branch; unused slots are nil.
+typedef struct {
+  Obj obj;
+  uint32_t edit;
+  Value slots[TRIE_WIDTH];
+} ObjVectorNode;
+
+// The last partial leaf is kept out of the trie as the tail, so pushes
+// only touch the trie once every TRIE_WIDTH items.
+typedef struct {
+  Obj obj;
+  uint32_t edit;
+  int count;
+  int shift; // Bits of the index consumed above the leaves.
+  ObjVectorNode *root;
+  ObjVectorNode *tail;
+} ObjVector;
+
+// A node of a hash array mapped trie. Each of its branches is empty, holds
+// one key and value inline (dataMap), or holds a child node (nodeMap).
+// Slots hold the inline pairs in branch order, then the children. Below
+// the last hash bits, keys whose hashes collide share a node with both
+// maps empty and only pairs in its slots.
+typedef struct {
+  Obj obj;
+  uint32_t edit;
+  uint32_t dataMap;
+  uint32_t nodeMap;
+  int slotCount;
+  Value slots[];
+} ObjMapNode;
+
+typedef struct {
+  Obj obj;
+  uint32_t edit;
+  int count;
+  ObjMapNode *root;
+} ObjMap;
+
 typedef struct ObjUpvalue {
   Obj obj;
   Value *location;
@@ -98,6 +270,8 @@ typedef struct {
 typedef struct {
   Obj ojb;
   ObjString *name;
+  Value initializer;
+  int fieldCount; // Fields to presize new instances for; see setProperty().
   Table methods;
 } ObjClass;
 
@@ -118,16 +292,36 @@ ObjClass *newClass(ObjString *name);
 ObjClosure *newClosure(ObjFunction *function);
 ObjFunction *newFunction();
 ObjInstance *newInstance(ObjClass *klass);
+ObjIterator *newIterator(IteratorKind kind, Value source, Value argument);
 ObjList *newList();
+ObjMap *newMap(ObjMapNode *root, int count, uint32_t edit);
+ObjMapNode *newMapNode(uint32_t edit, uint32_t dataMap, uint32_t nodeMap,
+                       int slotCount);
 void appendToList(ObjList *list, Value value);
 void storeToList(ObjList *list, int index, Value value);
 Value indexFromList(ObjList *list, int index);
+void insertToList(ObjList *list, int index, Value value);
 void deleteFromList(ObjList *list, int index);
 bool isValidListIndex(ObjList *list, int index);
+bool listContains(ObjList *list, Value value);
+bool tupleContains(ObjTuple *tuple, Value value);
+ObjList *concatenateLists(ObjList *a, ObjList *b);
+ObjList *repeatList(ObjList *list, int times);
 ObjNative *newNative(NativeFn function, int arity);
+ObjPriorityQueue *newPriorityQueue(Value comparator);
 ObjString *takeString(char *chars, int length);
 ObjString *copyString(const char *chars, int length);
+ObjString *stringCharAt(ObjString *string, int index);
+ObjString *nextStringChar(ObjString *string, int *offset);
+ObjTuple *newTuple(Value *items, int count);
+ObjStructType *newStructType(ObjString *name, int fieldCount);
+ObjStruct *newStruct(ObjStructType *type, Value *fields);
+ObjStruct *structWithField(ObjStruct *object, int index, Value value);
+int structFieldIndex(ObjStructType *type, ObjString *name);
 ObjUpvalue *newUpvalue(Value *slot);
+ObjVector *newVector(ObjVectorNode *root, ObjVectorNode *tail, int count,
+                     int shift, uint32_t edit);
+ObjVectorNode *newVectorNode(uint32_t edit);
 void printObject(Value value);
 
 static inline bool isObjType(Value value, ObjType type) {
@@ -0,0 +1,562 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "memory.h"
+#include "persistent.h"
+#include "vm.h"
+
+// Vectors follow the classic 32-way persistent vector: items live in the
+// leaves of a trie indexed by successive five-bit slices of the index, plus
+// a tail leaf. Maps are compressed hash array mapped tries (CHAMP). Both
+// copy only the nodes on the path they change, O(log32 n) of them.
+//
+// Every node allocated here is pushed until it is linked into something the
+// caller has rooted.
+
+static uint32_t nextEdit = 1;
+
+uint32_t newEditToken() {
+  if (nextEdit == 0)
+    nextEdit = 1;
+  return nextEdit++;
+}
+
+#define AS_VECTOR_NODE(value) ((ObjVectorNode *)AS_OBJ(value))
+#define AS_MAP_NODE(value) ((ObjMapNode *)AS_OBJ(value))
+
+// Persistent versions get a new header; transients change their own.
+static ObjVector *editableVector(ObjVector *vector) {
+  if (vector->edit != 0)
+    return vector;
+  return newVector(vector->root, vector->tail, vector->count, vector->shift,
+                   0);
+}
+
+static ObjVectorNode *editableVectorNode(ObjVectorNode *node, uint32_t edit) {
+  if (edit != 0 && node->edit == edit)
+    return node;
+  ObjVectorNode *copy = newVectorNode(edit);
+  memcpy(copy->slots, node->slots, sizeof(copy->slots));
+  return copy;
+}
+
+ObjVector *emptyVector(uint32_t edit) {
+  push(OBJ_VAL(newVectorNode(edit)));
+  push(OBJ_VAL(newVectorNode(edit)));
+  ObjVector *vector = newVector(AS_VECTOR_NODE(vm.stackTop[-2]),
+                                AS_VECTOR_NODE(vm.stackTop[-1]), 0, TRIE_BITS,
+                                edit);
+  pop();
+  pop();
+  return vector;
+}
+
+static int tailOffset(ObjVector *vector) {
+  if (vector->count < TRIE_WIDTH)
+    return 0;
+  return ((vector->count - 1) >> TRIE_BITS) << TRIE_BITS;
+}
+
+static ObjVectorNode *leafFor(ObjVector *vector, int index) {
+  if (index >= tailOffset(vector))
+    return vector->tail;
+  ObjVectorNode *node = vector->root;
+  for (int level = vector->shift; level > 0; level -= TRIE_BITS) {
+    node = AS_VECTOR_NODE(node->slots[(index >> level) & TRIE_MASK]);
+  }
+  return node;
+}
+
+Value vectorGet(ObjVector *vector, int index) {
+  return leafFor(vector, index)->slots[index & TRIE_MASK];
+}
+
+// A chain of single-child branches from level down to leaf.
+static ObjVectorNode *newPath(uint32_t edit, int level, ObjVectorNode *leaf) {
+  if (level == 0)
+    return leaf;
+  ObjVectorNode *child = newPath(edit, level - TRIE_BITS, leaf);
+  push(OBJ_VAL(child));
+  ObjVectorNode *path = newVectorNode(edit);
+  path->slots[0] = OBJ_VAL(child);
+  pop();
+  return path;
+}
+
+// Hangs the full tail off the rightmost edge of the trie. Uses the count
+// from before the push.
+static ObjVectorNode *pushTail(ObjVector *vector, int level,
+                               ObjVectorNode *parent, ObjVectorNode *leaf) {
+  ObjVectorNode *node = editableVectorNode(parent, vector->edit);
+  push(OBJ_VAL(node));
+  int branch = ((vector->count - 1) >> level) & TRIE_MASK;
+  ObjVectorNode *child;
+  if (level == TRIE_BITS) {
+    child = leaf;
+  } else if (!IS_NIL(node->slots[branch])) {
+    child = pushTail(vector, level - TRIE_BITS,
+                     AS_VECTOR_NODE(node->slots[branch]), leaf);
+  } else {
+    child = newPath(vector->edit, level - TRIE_BITS, leaf);
+  }
+  node->slots[branch] = OBJ_VAL(child);
+  pop();
+  return node;
+}
+
+ObjVector *vectorPush(ObjVector *vector, Value value) {
+  ObjVector *result = editableVector(vector);
+  push(OBJ_VAL(result));
+  int tailCount = result->count - tailOffset(result);
+  if (tailCount < TRIE_WIDTH) {
+    ObjVectorNode *tail = editableVectorNode(result->tail, result->edit);
+    tail->slots[tailCount] = value;
+    result->tail = tail;
+  } else {
+    ObjVectorNode *root;
+    int shift = result->shift;
+    if ((result->count >> TRIE_BITS) > (1 << result->shift)) {
+      // The trie is full, so it becomes the first child of a new root.
+      push(OBJ_VAL(newPath(result->edit, result->shift, result->tail)));
+      root = newVectorNode(result->edit);
+      root->slots[0] = OBJ_VAL(result->root);
+      root->slots[1] = pop();
+      shift += TRIE_BITS;
+    } else {
+      root = pushTail(result, result->shift, result->root, result->tail);
+    }
+    result->root = root;
+    result->shift = shift;
+
+    ObjVectorNode *tail = newVectorNode(result->edit);
+    tail->slots[0] = value;
+    result->tail = tail;
+  }
+  result->count++;
+  pop();
+  return result;
+}
+
+static ObjVectorNode *setInTrie(uint32_t edit, int level, ObjVectorNode *node,
+                                int index, Value value) {
+  ObjVectorNode *copy = editableVectorNode(node, edit);
+  if (level == 0) {
+    copy->slots[index & TRIE_MASK] = value;
+    return copy;
+  }
+  push(OBJ_VAL(copy));
+  int branch = (index >> level) & TRIE_MASK;
+  ObjVectorNode *child = setInTrie(
+      edit, level - TRIE_BITS, AS_VECTOR_NODE(copy->slots[branch]), index,
+      value);
+  copy->slots[branch] = OBJ_VAL(child);
+  pop();
+  return copy;
+}
+
+ObjVector *vectorSet(ObjVector *vector, int index, Value value) {
+  ObjVector *result = editableVector(vector);
+  push(OBJ_VAL(result));
+  if (index >= tailOffset(result)) {
+    ObjVectorNode *tail = editableVectorNode(result->tail, result->edit);
+    tail->slots[index & TRIE_MASK] = value;
+    result->tail = tail;
+  } else {
+    result->root =
+        setInTrie(result->edit, result->shift, result->root, index, value);
+  }
+  pop();
+  return result;
+}
+
+// Cuts the rightmost leaf out of the trie, returning NULL for a branch left
+// empty. Uses the count from before the pop.
+static ObjVectorNode *popTail(ObjVector *vector, int level,
+                              ObjVectorNode *node) {
+  int branch = ((vector->count - 2) >> level) & TRIE_MASK;
+  if (level > TRIE_BITS) {
+    ObjVectorNode *child = popTail(vector, level - TRIE_BITS,
+                                   AS_VECTOR_NODE(node->slots[branch]));
+    if (child == NULL && branch == 0)
+      return NULL;
+    push(child == NULL ? NIL_VAL : OBJ_VAL(child));
+    ObjVectorNode *copy = editableVectorNode(node, vector->edit);
+    copy->slots[branch] = pop();
+    return copy;
+  }
+  if (branch == 0)
+    return NULL;
+  ObjVectorNode *copy = editableVectorNode(node, vector->edit);
+  copy->slots[branch] = NIL_VAL;
+  return copy;
+}
+
+ObjVector *vectorPop(ObjVector *vector) {
+  ObjVector *result = editableVector(vector);
+  push(OBJ_VAL(result));
+  int tailCount = result->count - tailOffset(result);
+  if (result->count == 1 || tailCount > 1) {
+    ObjVectorNode *tail = editableVectorNode(result->tail, result->edit);
+    tail->slots[tailCount - 1] = NIL_VAL;
+    result->tail = tail;
+  } else {
+    // The tail empties, so the last leaf of the trie takes its place. A
+    // transient may unlink it in place, so keep it rooted meanwhile.
+    ObjVectorNode *tail = leafFor(result, result->count - 2);
+    push(OBJ_VAL(tail));
+    ObjVectorNode *root = popTail(result, result->shift, result->root);
+    int shift = result->shift;
+    if (root == NULL) {
+      root = newVectorNode(result->edit);
+    } else if (shift > TRIE_BITS && IS_NIL(root->slots[1])) {
+      root = AS_VECTOR_NODE(root->slots[0]);
+      shift -= TRIE_BITS;
+    }
+    result->root = root;
+    result->shift = shift;
+    result->tail = tail;
+    pop();
+  }
+  result->count--;
+  pop();
+  return result;
+}
+
+bool vectorContains(ObjVector *vector, Value value) {
+  for (int start = 0; start < vector->count; start += TRIE_WIDTH) {
+    ObjVectorNode *leaf = leafFor(vector, start);
+    int end = vector->count - start < TRIE_WIDTH ? vector->count - start
+                                                 : TRIE_WIDTH;
+    for (int i = 0; i < end; i++) {
+      if (valuesEqual(leaf->slots[i], value))
+        return true;
+    }
+  }
+  return false;
+}
+
+void printVector(ObjVector *vector) {
+  printf("Vector[");
+  for (int i = 0; i < vector->count; i++) {
+    printValue(vectorGet(vector, i));
+    if (i < vector->count - 1) {
+      printf(", ");
+    }
+  }
+  printf("]");
+}
+
+// Below this shift the hash is used up and keys can only collide.
+#define MAP_MAX_SHIFT 30
+
+static ObjMap *editableMap(ObjMap *map) {
+  if (map->edit != 0)
+    return map;
+  return newMap(map->root, map->count, 0);
+}
+
+static ObjMapNode *editableMapNode(ObjMapNode *node, uint32_t edit) {
+  if (edit != 0 && node->edit == edit)
+    return node;
+  ObjMapNode *copy =
+      newMapNode(edit, node->dataMap, node->nodeMap, node->slotCount);
+  memcpy(copy->slots, node->slots, sizeof(Value) * node->slotCount);
+  return copy;
+}
+
+ObjMap *emptyMap(uint32_t edit) {
+  push(OBJ_VAL(newMapNode(edit, 0, 0, 0)));
+  ObjMap *map = newMap(AS_MAP_NODE(vm.stackTop[-1]), 0, edit);
+  pop();
+  return map;
+}
+
+static int bitCount(uint32_t bits) {
+  bits = bits - ((bits >> 1) & 0x55555555);
+  bits = (bits & 0x33333333) + ((bits >> 2) & 0x33333333);
+  return (int)((((bits + (bits >> 4)) & 0x0F0F0F0F) * 0x01010101) >> 24);
+}
+
+static uint32_t branchBit(uint32_t hash, int shift) {
+  return 1u << ((hash >> shift) & TRIE_MASK);
+}
+
+static int pairSlot(ObjMapNode *node, uint32_t bit) {
+  return 2 * bitCount(node->dataMap & (bit - 1));
+}
+
+static int childSlot(ObjMapNode *node, uint32_t bit) {
+  return 2 * bitCount(node->dataMap) + bitCount(node->nodeMap & (bit - 1));
+}
+
+bool mapGet(ObjMap *map, Value key, Value *value) {
+  uint32_t hash = hashValue(key);
+  ObjMapNode *node = map->root;
+  for (int shift = 0;; shift += TRIE_BITS) {
+    if (shift > MAP_MAX_SHIFT) {
+      for (int i = 0; i < node->slotCount; i += 2) {
+        if (valuesEqual(node->slots[i], key)) {
+          *value = node->slots[i + 1];
+          return true;
+        }
+      }
+      return false;
+    }
+
+    uint32_t bit = branchBit(hash, shift);
+    if (node->dataMap & bit) {
+      int slot = pairSlot(node, bit);
+      if (!valuesEqual(node->slots[slot], key))
+        return false;
+      *value = node->slots[slot + 1];
+      return true;
+    }
+    if (!(node->nodeMap & bit))
+      return false;
+    node = AS_MAP_NODE(node->slots[childSlot(node, bit)]);
+  }
+}
+
+// Copies node's slots into a new node of a different size, leaving a gap
+// of gapSize slots at gapAt in the result and skipping skipSize slots at
+// skipAt in the source.
+static ObjMapNode *resizedMapNode(uint32_t edit, ObjMapNode *node,
+                                  uint32_t dataMap, uint32_t nodeMap,
+                                  int skipAt, int skipSize, int gapAt,
+                                  int gapSize) {
+  int slotCount = node->slotCount - skipSize + gapSize;
+  ObjMapNode *result = newMapNode(edit, dataMap, nodeMap, slotCount);
+  int to = 0;
+  for (int from = 0; from <= node->slotCount; from++) {
+    if (to == gapAt)
+      to += gapSize;
+    if (from == skipAt)
+      from += skipSize;
+    if (from >= node->slotCount)
+      break;
+    result->slots[to++] = node->slots[from];
+  }
+  return result;
+}
+
+// Two pairs whose hashes agree below shift, in a new subtree.
+static ObjMapNode *mergePairs(uint32_t edit, int shift, Value key1,
+                              Value value1, uint32_t hash1, Value key2,
+                              Value value2, uint32_t hash2) {
+  if (shift > MAP_MAX_SHIFT) {
+    ObjMapNode *node = newMapNode(edit, 0, 0, 4);
+    node->slots[0] = key1;
+    node->slots[1] = value1;
+    node->slots[2] = key2;
+    node->slots[3] = value2;
+    return node;
+  }
+
+  uint32_t bit1 = branchBit(hash1, shift);
+  uint32_t bit2 = branchBit(hash2, shift);
+  if (bit1 == bit2) {
+    push(OBJ_VAL(mergePairs(edit, shift + TRIE_BITS, key1, value1, hash1, key2,
+                            value2, hash2)));
+    ObjMapNode *node = newMapNode(edit, 0, bit1, 1);
+    node->slots[0] = pop();
+    return node;
+  }
+
+  ObjMapNode *node = newMapNode(edit, bit1 | bit2, 0, 4);
+  int first = bit1 < bit2 ? 0 : 2;
+  node->slots[first] = key1;
+  node->slots[first + 1] = value1;
+  node->slots[2 - first] = key2;
+  node->slots[3 - first] = value2;
+  return node;
+}
+
+// Returns node with key set to value: node itself when it was changed in
+// place, otherwise a new node.
+static ObjMapNode *setInNode(uint32_t edit, ObjMapNode *node, int shift,
+                             Value key, Value value, uint32_t hash,
+                             bool *added) {
+  if (shift > MAP_MAX_SHIFT) {
+    for (int i = 0; i < node->slotCount; i += 2) {
+      if (valuesEqual(node->slots[i], key)) {
+        ObjMapNode *copy = editableMapNode(node, edit);
+        copy->slots[i + 1] = value;
+        return copy;
+      }
+    }
+    *added = true;
+    ObjMapNode *grown = resizedMapNode(edit, node, 0, 0, -1, 0,
+                                       node->slotCount, 2);
+    grown->slots[node->slotCount] = key;
+    grown->slots[node->slotCount + 1] = value;
+    return grown;
+  }
+
+  uint32_t bit = branchBit(hash, shift);
+  if (node->dataMap & bit) {
+    int slot = pairSlot(node, bit);
+    Value existing = node->slots[slot];
+    if (valuesEqual(existing, key)) {
+      ObjMapNode *copy = editableMapNode(node, edit);
+      copy->slots[slot + 1] = value;
+      return copy;
+    }
+
+    // Both pairs move down into a new child.
+    *added = true;
+    ObjMapNode *child =
+        mergePairs(edit, shift + TRIE_BITS, existing, node->slots[slot + 1],
+                   hashValue(existing), key, value, hash);
+    push(OBJ_VAL(child));
+    int at = childSlot(node, bit) - 2;
+    ObjMapNode *result =
+        resizedMapNode(edit, node, node->dataMap ^ bit, node->nodeMap | bit,
+                       slot, 2, at, 1);
+    result->slots[at] = OBJ_VAL(child);
+    pop();
+    return result;
+  }
+
+  if (node->nodeMap & bit) {
+    int slot = childSlot(node, bit);
+    ObjMapNode *child = AS_MAP_NODE(node->slots[slot]);
+    ObjMapNode *updated =
+        setInNode(edit, child, shift + TRIE_BITS, key, value, hash, added);
+    if (updated == child)
+      return node;
+    push(OBJ_VAL(updated));
+    ObjMapNode *copy = editableMapNode(node, edit);
+    copy->slots[slot] = pop();
+    return copy;
+  }
+
+  *added = true;
+  int slot = pairSlot(node, bit);
+  ObjMapNode *result = resizedMapNode(edit, node, node->dataMap | bit,
+                                      node->nodeMap, -1, 0, slot, 2);
+  result->slots[slot] = key;
+  result->slots[slot + 1] = value;
+  return result;
+}
+
+ObjMap *mapSet(ObjMap *map, Value key, Value value) {
+  ObjMap *result = editableMap(map);
+  push(OBJ_VAL(result));
+  bool added = false;
+  result->root = setInNode(result->edit, result->root, 0, key, value,
+                           hashValue(key), &added);
+  if (added)
+    result->count++;
+  pop();
+  return result;
+}
+
+// A node holding one pair and no children can be inlined into its parent.
+static bool isSinglePair(ObjMapNode *node) {
+  return node->nodeMap == 0 && node->slotCount == 2;
+}
+
+static ObjMapNode *deleteFromNode(uint32_t edit, ObjMapNode *node, int shift,
+                                  Value key, uint32_t hash, bool *removed) {
+  if (shift > MAP_MAX_SHIFT) {
+    for (int i = 0; i < node->slotCount; i += 2) {
+      if (valuesEqual(node->slots[i], key)) {
+        *removed = true;
+        return resizedMapNode(edit, node, 0, 0, i, 2, -1, 0);
+      }
+    }
+    return node;
+  }
+
+  uint32_t bit = branchBit(hash, shift);
+  if (node->dataMap & bit) {
+    int slot = pairSlot(node, bit);
+    if (!valuesEqual(node->slots[slot], key))
+      return node;
+    *removed = true;
+    return resizedMapNode(edit, node, node->dataMap ^ bit, node->nodeMap, slot,
+                          2, -1, 0);
+  }
+
+  if (node->nodeMap & bit) {
+    int slot = childSlot(node, bit);
+    ObjMapNode *child = AS_MAP_NODE(node->slots[slot]);
+    ObjMapNode *updated =
+        deleteFromNode(edit, child, shift + TRIE_BITS, key, hash, removed);
+    if (!*removed)
+      return node;
+
+    push(OBJ_VAL(updated));
+    ObjMapNode *result;
+    if (isSinglePair(updated)) {
+      int at = pairSlot(node, bit);
+      result = resizedMapNode(edit, node, node->dataMap | bit,
+                              node->nodeMap ^ bit, slot, 1, at, 2);
+      result->slots[at] = updated->slots[0];
+      result->slots[at + 1] = updated->slots[1];
+    } else if (updated == child) {
+      result = node;
+    } else {
+      result = editableMapNode(node, edit);
+      result->slots[slot] = OBJ_VAL(updated);
+    }
+    pop();
+    return result;
+  }
+  return node;
+}
+
+ObjMap *mapDelete(ObjMap *map, Value key) {
+  ObjMap *result = editableMap(map);
+  push(OBJ_VAL(result));
+  bool removed = false;
+  result->root = deleteFromNode(result->edit, result->root, 0, key,
+                                hashValue(key), &removed);
+  if (removed)
+    result->count--;
+  pop();
+  return result;
+}
+
+static void nodeEntries(ObjMapNode *node, ObjList *keys, ObjList *values) {
+  int pairEnd = 2 * bitCount(node->dataMap);
+  if (node->dataMap == 0 && node->nodeMap == 0)
+    pairEnd = node->slotCount;
+  for (int i = 0; i < pairEnd; i += 2) {
+    if (keys != NULL)
+      appendToList(keys, node->slots[i]);
+    if (values != NULL)
+      appendToList(values, node->slots[i + 1]);
+  }
+  for (int i = pairEnd; i < node->slotCount; i++) {
+    nodeEntries(AS_MAP_NODE(node->slots[i]), keys, values);
+  }
+}
+
+void mapEntries(ObjMap *map, ObjList *keys, ObjList *values) {
+  nodeEntries(map->root, keys, values);
+}
+
+static bool printNode(ObjMapNode *node, bool first) {
+  int pairEnd = 2 * bitCount(node->dataMap);
+  if (node->dataMap == 0 && node->nodeMap == 0)
+    pairEnd = node->slotCount;
+  for (int i = 0; i < pairEnd; i += 2) {
+    if (!first)
+      printf(", ");
+    first = false;
+    printValue(node->slots[i]);
+    printf(": ");
+    printValue(node->slots[i + 1]);
+  }
+  for (int i = pairEnd; i < node->slotCount; i++) {
+    first = printNode(AS_MAP_NODE(node->slots[i]), first);
+  }
+  return first;
+}
+
+void printMap(ObjMap *map) {
+  printf("Map{");
+  printNode(map->root, true);
+  printf("}");
+}
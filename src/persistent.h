@@ -0,0 +1,31 @@
+#ifndef clang_persistent_h
+#define clang_persistent_h
+
+#include "object.h"
+
+// Persistent vectors and maps. Operations on a persistent version return a
+// new version and leave the original untouched; on a transient they change
+// it in place and return it. Every function expects its collection, keys
+// and values are already trackable by GC i.e. on stack.
+
+// A token no transient has used, for stamping the nodes a new one makes.
+uint32_t newEditToken();
+
+ObjVector *emptyVector(uint32_t edit);
+Value vectorGet(ObjVector *vector, int index);
+ObjVector *vectorPush(ObjVector *vector, Value value);
+ObjVector *vectorSet(ObjVector *vector, int index, Value value);
+ObjVector *vectorPop(ObjVector *vector);
+bool vectorContains(ObjVector *vector, Value value);
+void printVector(ObjVector *vector);
+
+ObjMap *emptyMap(uint32_t edit);
+bool mapGet(ObjMap *map, Value key, Value *value);
+ObjMap *mapSet(ObjMap *map, Value key, Value value);
+ObjMap *mapDelete(ObjMap *map, Value key);
+// Appends every key and value, in the same order, to whichever of the
+// lists is not NULL.
+void mapEntries(ObjMap *map, ObjList *keys, ObjList *values);
+void printMap(ObjMap *map);
+
+#endif // clang_persistent_h
@@ -111,9 +111,14 @@ static TokenType identifierType() {
     if (scanner.current - scanner.start > 1) {
       switch (scanner.start[1]) {
       case 'a':
+        if (scanner.current - scanner.start > 2 && scanner.start[2] == 't') {
+          return checkKeyword(3, 2, "ch", TOKEN_CATCH);
+        }
         return checkKeyword(2, 2, "se", TOKEN_CASE);
       case 'l':
         return checkKeyword(2, 3, "ass", TOKEN_CLASS);
+      case 'o':
+        return checkKeyword(2, 3, "nst", TOKEN_CONST);
       }
     }
     break;
@@ -135,7 +140,15 @@ static TokenType identifierType() {
     }
     break;
   case 'i':
-    return checkKeyword(1, 1, "f", TOKEN_IF);
+    if (scanner.current - scanner.start == 2) {
+      switch (scanner.start[1]) {
+      case 'f':
+        return TOKEN_IF;
+      case 'n':
+        return TOKEN_IN;
+      }
+    }
+    break;
   case 'n':
     return checkKeyword(1, 2, "il", TOKEN_NIL);
   case 'o':
@@ -147,6 +160,8 @@ static TokenType identifierType() {
   case 's': {
     if (scanner.current - scanner.start > 1) {
       switch (scanner.start[1]) {
+      case 't':
+        return checkKeyword(2, 4, "ruct", TOKEN_STRUCT);
       case 'u':
         return checkKeyword(2, 3, "per", TOKEN_SUPER);
       case 'w':
@@ -159,8 +174,14 @@ static TokenType identifierType() {
     if (scanner.current - scanner.start > 1) {
       switch (scanner.start[1]) {
       case 'h':
+        if (scanner.current - scanner.start > 2 && scanner.start[2] == 'r') {
+          return checkKeyword(3, 2, "ow", TOKEN_THROW);
+        }
         return checkKeyword(2, 2, "is", TOKEN_THIS);
       case 'r':
+        if (scanner.current - scanner.start > 2 && scanner.start[2] == 'y') {
+          return checkKeyword(3, 0, "", TOKEN_TRY);
+        }
         return checkKeyword(2, 2, "ue", TOKEN_TRUE);
       }
     }
@@ -242,13 +263,17 @@ Token scanToken() {
   case '.':
     return makeToken(TOKEN_DOT);
   case '-':
-    return makeToken(TOKEN_MINUS);
+    if (match('-'))
+      return makeToken(TOKEN_MINUS_MINUS);
+    return makeToken(match('=') ? TOKEN_MINUS_EQUAL : TOKEN_MINUS);
   case '+':
-    return makeToken(TOKEN_PLUS);
+    if (match('+'))
+      return makeToken(TOKEN_PLUS_PLUS);
+    return makeToken(match('=') ? TOKEN_PLUS_EQUAL : TOKEN_PLUS);
   case '/':
-    return makeToken(TOKEN_SLASH);
+    return makeToken(match('=') ? TOKEN_SLASH_EQUAL : TOKEN_SLASH);
   case '*':
-    return makeToken(TOKEN_STAR);
+    return makeToken(match('=') ? TOKEN_STAR_EQUAL : TOKEN_STAR);
   case '!':
     return makeToken(match('=') ? TOKEN_BANG_EQUAL : TOKEN_BANG);
   case '=':
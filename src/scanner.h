@@ -26,6 +26,12 @@ typedef enum {
   TOKEN_GREATER_EQUAL,
   TOKEN_LESS,
   TOKEN_LESS_EQUAL,
+  TOKEN_MINUS_EQUAL,
+  TOKEN_MINUS_MINUS,
+  TOKEN_PLUS_EQUAL,
+  TOKEN_PLUS_PLUS,
+  TOKEN_SLASH_EQUAL,
+  TOKEN_STAR_EQUAL,
   // Literals.
   TOKEN_IDENTIFIER,
   TOKEN_STRING,
@@ -51,6 +57,12 @@ typedef enum {
   TOKEN_DEFAULT,
   TOKEN_SWITCH,
   TOKEN_BREAK,
+  TOKEN_STRUCT,
+  TOKEN_CONST,
+  TOKEN_TRY,
+  TOKEN_CATCH,
+  TOKEN_THROW,
+  TOKEN_IN,
 
   TOKEN_ERROR,
   TOKEN_EOF
@@ -54,6 +54,18 @@ bool tableGet(Table *table, ObjString *key, Value *value) {
   return true;
 }
 
+Value *tableGetRef(Table *table, ObjString *key) {
+  // The returned slot is only valid until the table is next resized.
+  if (table->count == 0)
+    return NULL;
+
+  Entry *entry = findEntry(table->entries, table->capacity, key);
+  if (entry->key == NULL)
+    return NULL;
+
+  return &entry->value;
+}
+
 static void adjustCapacity(Table *table, int capacity) {
   Entry *entries = ALLOCATE(Entry, capacity);
   for (int i = 0; i < capacity; i++) {
@@ -117,6 +129,16 @@ void tableAddAll(Table *from, Table *to) {
   }
 }
 
+void tableReserve(Table *table, int count) {
+  int capacity = table->capacity;
+  while (count > capacity * TABLE_MAX_LOAD) {
+    capacity = GROW_CAPACITY(capacity);
+  }
+  if (capacity > table->capacity) {
+    adjustCapacity(table, capacity);
+  }
+}
+
 ObjString *tableFindString(Table *table, const char *chars, int length,
                            uint32_t hash) {
   if (table->count == 0)
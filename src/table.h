@@ -18,9 +18,11 @@ typedef struct {
 void initTable(Table *table);
 void freeTable(Table *table);
 bool tableGet(Table *table, ObjString *key, Value *value);
+Value *tableGetRef(Table *table, ObjString *key);
 bool tableSet(Table *table, ObjString *key, Value value);
 bool tableDelete(Table *table, ObjString *key);
 void tableAddAll(Table *from, Table *to);
+void tableReserve(Table *table, int count);
 ObjString *tableFindString(Table *table, const char *chars, int length,
                            uint32_t hash);
 void tableRemoveWhite(Table *table);
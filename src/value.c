@@ -56,9 +56,85 @@ bool valuesEqual(Value a, Value b) {
   case VAL_NUMBER:
     return AS_NUMBER(a) == AS_NUMBER(b);
   case VAL_OBJ: {
-    return AS_OBJ(a) == AS_OBJ(b);
+    if (AS_OBJ(a) == AS_OBJ(b))
+      return true;
+    if (IS_BOUND_METHOD(a) && IS_BOUND_METHOD(b)) {
+      // The VM may or may not hand back a cached binding, so two bindings
+      // of one method to one receiver are equal either way.
+      ObjBoundMethod *x = AS_BOUND_METHOD(a);
+      ObjBoundMethod *y = AS_BOUND_METHOD(b);
+      return x->method == y->method && valuesEqual(x->receiver, y->receiver);
+    }
+    if (IS_STRUCT(a) && IS_STRUCT(b)) {
+      // Structs are values, so they compare field by field too.
+      ObjStruct *x = AS_STRUCT(a);
+      ObjStruct *y = AS_STRUCT(b);
+      if (x->type != y->type || x->hash != y->hash)
+        return false;
+      for (int i = 0; i < x->fieldCount; i++) {
+        if (!valuesEqual(x->fields[i], y->fields[i]))
+          return false;
+      }
+      return true;
+    }
+    if (!IS_TUPLE(a) || !IS_TUPLE(b))
+      return false;
+
+    // Tuples compare structurally.
+    ObjTuple *x = AS_TUPLE(a);
+    ObjTuple *y = AS_TUPLE(b);
+    if (x->count != y->count || x->hash != y->hash)
+      return false;
+    for (int i = 0; i < x->count; i++) {
+      if (!valuesEqual(x->items[i], y->items[i]))
+        return false;
+    }
+    return true;
   }
   default:
     return false;
   }
 }
+
+static uint32_t hashBits(uint64_t bits) {
+  bits = (~bits) + (bits << 18);
+  bits = bits ^ (bits >> 31);
+  bits = bits * 21;
+  bits = bits ^ (bits >> 11);
+  bits = bits + (bits << 6);
+  bits = bits ^ (bits >> 22);
+  return (uint32_t)(bits & 0x3fffffff);
+}
+
+uint32_t hashValue(Value value) {
+  // Values that are equal under valuesEqual hash the same.
+  switch (value.type) {
+  case VAL_BOOL:
+    return AS_BOOL(value) ? 3 : 5;
+  case VAL_NIL:
+    return 7;
+  case VAL_NUMBER: {
+    double number = AS_NUMBER(value) + 0.0; // Fold -0 into 0.
+    uint64_t bits;
+    memcpy(&bits, &number, sizeof(bits));
+    return hashBits(bits);
+  }
+  case VAL_OBJ:
+    switch (OBJ_TYPE(value)) {
+    case OBJ_STRING:
+      return AS_STRING(value)->hash;
+    case OBJ_TUPLE:
+      return AS_TUPLE(value)->hash;
+    case OBJ_STRUCT:
+      return AS_STRUCT(value)->hash;
+    case OBJ_BOUND_METHOD: {
+      ObjBoundMethod *bound = AS_BOUND_METHOD(value);
+      return hashValue(bound->receiver) ^
+             hashBits((uint64_t)(uintptr_t)bound->method);
+    }
+    default:
+      return hashBits((uint64_t)(uintptr_t)AS_OBJ(value));
+    }
+  }
+  return 0;
+}
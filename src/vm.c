@@ -3,9 +3,13 @@
 #include "common.h"
 #include "compiler.h"
 #include "debug.h"
+#include "debugger.h"
 #include "memory.h"
 #include "object.h"
+#include "persistent.h"
 #include "value.h"
+#include <ctype.h>
+#include <limits.h>
 #include <stdarg.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -19,6 +23,9 @@
   ((NativeResult){.isError = true,                                             \
                   .result =                                                    \
                       OBJ_VAL(copyString((message), (int)strlen(message)))})
+// Passes on an exception raised by script code the native called.
+#define NATIVE_RETHROW(exception)                                              \
+  ((NativeResult){.isError = true, .result = (exception)})
 
 VM vm;
 
@@ -26,18 +33,95 @@ static NativeResult clockNative(int argCount, Value *args) {
   return NATIVE_SUCCESS(NUMBER_VAL((double)clock() / CLOCKS_PER_SEC));
 }
 
+static NativeResult collectNative(int argCount, Value *args) {
+  (void)argCount;
+  (void)args;
+  size_t before = vm.bytesAllocated;
+  collectGarbage();
+  return NATIVE_SUCCESS(NUMBER_VAL((double)(before - vm.bytesAllocated)));
+}
+
+static NativeResult pauseGCNative(int argCount, Value *args) {
+  (void)argCount;
+  (void)args;
+  vm.gcPauseDepth++;
+  return NATIVE_SUCCESS(NIL_VAL);
+}
+
+static NativeResult resumeGCNative(int argCount, Value *args) {
+  (void)argCount;
+  (void)args;
+  if (vm.gcPauseDepth == 0) {
+    return NATIVE_ERROR("resumeGC() called without a matching pauseGC().");
+  }
+  vm.gcPauseDepth--;
+  return NATIVE_SUCCESS(NIL_VAL);
+}
+
+static NativeResult gcAllocatedNative(int argCount, Value *args) {
+  (void)argCount;
+  (void)args;
+  return NATIVE_SUCCESS(NUMBER_VAL((double)vm.bytesSinceGC));
+}
+
 static void resetStack() {
   vm.stackTop = vm.stack;
   vm.frameCount = 0;
+  vm.baseFrame = 0;
   vm.openUpvalues = NULL;
+  // A pauseGC() left unmatched by an uncaught error mustn't outlive it.
+  vm.gcPauseDepth = 0;
 }
 
-static void runtimeError(const char *format, ...) {
-  va_list args;
-  va_start(args, format);
-  vfprintf(stderr, format, args);
-  va_end(args);
-  fputs("\n", stderr);
+static void closeUpvalues(Value *last);
+
+// Finds the innermost try block covering the current instruction of a frame
+// at or above lowest, returning its frame index or -1.
+static int findHandler(int lowest, ExceptionHandler **found) {
+  for (int i = vm.frameCount - 1; i >= lowest; i--) {
+    CallFrame *frame = &vm.frames[i];
+    Chunk *chunk = &frame->closure->function->chunk;
+    int offset = (int)(frame->ip - chunk->code) - 1;
+
+    for (int j = 0; j < chunk->handlerCount; j++) {
+      ExceptionHandler *handler = &chunk->handlers[j];
+      if (offset >= handler->start && offset < handler->end) {
+        *found = handler;
+        return i;
+      }
+    }
+  }
+  return -1;
+}
+
+static bool catchException(Value exception) {
+  // Unwinds to the innermost try block and pushes the exception for the
+  // handler. The handler table is only consulted here, so code that doesn't
+  // throw pays nothing for it.
+  ExceptionHandler *handler;
+  int i = findHandler(vm.baseFrame, &handler);
+  if (i != -1) {
+    CallFrame *frame = &vm.frames[i];
+    closeUpvalues(frame->slots + handler->stackDepth);
+    vm.stackTop = frame->slots + handler->stackDepth;
+    vm.frameCount = i + 1;
+    frame->ip = frame->closure->function->chunk.code + handler->handler;
+    push(exception);
+    return true;
+  }
+
+  // Inside a call made from a native, a handler further out is reached by
+  // unwinding to the native, which rethrows the exception left on the stack.
+  if (vm.baseFrame > 0 && findHandler(0, &handler) != -1) {
+    vm.frameCount = vm.baseFrame;
+    push(exception);
+    return true;
+  }
+  return false;
+}
+
+static void reportError(const char *message) {
+  fprintf(stderr, "%s\n", message);
 
   // Print the call stack
   if (vm.frameCount > 0 && vm.frameCount <= FRAMES_MAX) {
@@ -71,6 +155,35 @@ static void runtimeError(const char *format, ...) {
   resetStack();
 }
 
+static void runtimeError(const char *format, ...) {
+  char message[256];
+  va_list args;
+  va_start(args, format);
+  int length = vsnprintf(message, sizeof(message), format, args);
+  va_end(args);
+  if (length >= (int)sizeof(message)) {
+    length = sizeof(message) - 1;
+  }
+
+  // A try block receives the message as a string.
+  if (!catchException(OBJ_VAL(copyString(message, length)))) {
+    reportError(message);
+  }
+}
+
+static void nativeError(Value error) {
+  // An error from a script the native called has already been reported.
+  if (vm.frameCount == 0)
+    return;
+
+  // Natives report errors as values, which a try block receives unchanged.
+  if (!catchException(error)) {
+    char message[256];
+    snprintf(message, sizeof(message), "Native error: %s", AS_CSTRING(error));
+    reportError(message);
+  }
+}
+
 static NativeResult readFileNative(int argCount, Value *args) {
   if (argCount != 1) {
     return NATIVE_ERROR("readFile() takes exactly 1 argument.");
@@ -144,6 +257,776 @@ static NativeResult deleteNative(int argCount, Value *args) {
   deleteFromList(list, index);
   return NATIVE_SUCCESS(NIL_VAL);
 }
+
+// Built-in methods receive the receiver in args[0], followed by the call's
+// arguments. Their arity excludes the receiver.
+
+static NativeResult listAppendMethod(int argCount, Value *args) {
+  (void)argCount;
+  appendToList(AS_LIST(args[0]), args[1]);
+  return NATIVE_SUCCESS(NIL_VAL);
+}
+
+static NativeResult listInsertMethod(int argCount, Value *args) {
+  (void)argCount;
+  ObjList *list = AS_LIST(args[0]);
+  if (!IS_NUMBER(args[1])) {
+    return NATIVE_ERROR("insert() index must be a number.");
+  }
+  int index = AS_NUMBER(args[1]);
+  if (index < 0 || index > list->count) {
+    return NATIVE_ERROR("Index out of bounds");
+  }
+  insertToList(list, index, args[2]);
+  return NATIVE_SUCCESS(NIL_VAL);
+}
+
+static NativeResult listDeleteMethod(int argCount, Value *args) {
+  (void)argCount;
+  ObjList *list = AS_LIST(args[0]);
+  if (!IS_NUMBER(args[1])) {
+    return NATIVE_ERROR("delete() index must be a number.");
+  }
+  int index = AS_NUMBER(args[1]);
+  if (!isValidListIndex(list, index)) {
+    return NATIVE_ERROR("Index out of bounds");
+  }
+  deleteFromList(list, index);
+  return NATIVE_SUCCESS(NIL_VAL);
+}
+
+static NativeResult listPopMethod(int argCount, Value *args) {
+  (void)argCount;
+  ObjList *list = AS_LIST(args[0]);
+  if (list->count == 0) {
+    return NATIVE_ERROR("pop() from an empty list.");
+  }
+  Value item = indexFromList(list, list->count - 1);
+  deleteFromList(list, list->count - 1);
+  return NATIVE_SUCCESS(item);
+}
+
+static NativeResult listLenMethod(int argCount, Value *args) {
+  (void)argCount;
+  return NATIVE_SUCCESS(NUMBER_VAL(AS_LIST(args[0])->count));
+}
+
+static NativeResult stringLenMethod(int argCount, Value *args) {
+  (void)argCount;
+  return NATIVE_SUCCESS(NUMBER_VAL(AS_STRING(args[0])->charCount));
+}
+
+static NativeResult tupleLenMethod(int argCount, Value *args) {
+  (void)argCount;
+  return NATIVE_SUCCESS(NUMBER_VAL(AS_TUPLE(args[0])->count));
+}
+
+static NativeResult changeCase(ObjString *string, int (*convert)(int)) {
+  char *chars = ALLOCATE(char, string->length + 1);
+  for (int i = 0; i < string->length; i++) {
+    chars[i] = (char)convert((unsigned char)string->chars[i]);
+  }
+  chars[string->length] = '\0';
+  return NATIVE_SUCCESS(OBJ_VAL(takeString(chars, string->length)));
+}
+
+static NativeResult stringUpperMethod(int argCount, Value *args) {
+  (void)argCount;
+  return changeCase(AS_STRING(args[0]), toupper);
+}
+
+static NativeResult stringLowerMethod(int argCount, Value *args) {
+  (void)argCount;
+  return changeCase(AS_STRING(args[0]), tolower);
+}
+
+static inline bool callValue(Value callee, int argCount);
+static bool isFalsey(Value value);
+static InterpretResult run();
+static void preempt();
+
+// Calls the callee below the top argCount values from inside a native, leaving
+// its result in *result. Returns false if the call raised an error: either it
+// was reported and the stack reset, or a try block further out will take it,
+// in which case *result is the exception for the native to rethrow.
+static bool callFromNative(int argCount, Value *result) {
+  int baseFrame = vm.baseFrame;
+  vm.baseFrame = vm.frameCount;
+  // Callbacks like these may never loop, so they pay fuel here as calls do.
+  bool ok;
+  if (--vm.fuel == 0 ||
+      atomic_load_explicit(&vm.interrupted, memory_order_relaxed)) {
+    preempt();
+    ok = false;
+  } else {
+    ok = callValue(vm.stackTop[-argCount - 1], argCount);
+  }
+  // run() also stops at a try block inside the callee, which resumes here.
+  while (ok && vm.frameCount > vm.baseFrame) {
+    if (run() != INTERPRET_OK && vm.frameCount <= vm.baseFrame) {
+      ok = false;
+    }
+  }
+  vm.baseFrame = baseFrame;
+
+  if (vm.frameCount == 0) {
+    *result = NIL_VAL;
+    return false;
+  }
+  *result = pop();
+  return ok;
+}
+
+typedef enum {
+  PULL_VALUE,
+  PULL_DONE,
+  PULL_ERROR, // *value holds the exception to rethrow.
+} PullResult;
+
+// Produces the next element of a pipeline, pulling through each stage in
+// turn. Values held across a call into the script are kept on the stack.
+static PullResult pullIterator(ObjIterator *iterator, Value *value) {
+  switch (iterator->kind) {
+  case ITER_SEQUENCE:
+    if (IS_LIST(iterator->source)) {
+      ObjList *list = AS_LIST(iterator->source);
+      if (iterator->position >= list->count)
+        return PULL_DONE;
+      *value = indexFromList(list, iterator->position++);
+    } else if (IS_STRING(iterator->source)) {
+      ObjString *string = AS_STRING(iterator->source);
+      if (iterator->offset >= string->length)
+        return PULL_DONE;
+      *value = OBJ_VAL(nextStringChar(string, &iterator->offset));
+      iterator->position++;
+    } else if (IS_VECTOR(iterator->source)) {
+      ObjVector *vector = AS_VECTOR(iterator->source);
+      if (iterator->position >= vector->count)
+        return PULL_DONE;
+      *value = vectorGet(vector, iterator->position++);
+    } else {
+      ObjTuple *tuple = AS_TUPLE(iterator->source);
+      if (iterator->position >= tuple->count)
+        return PULL_DONE;
+      *value = tuple->items[iterator->position++];
+    }
+    return PULL_VALUE;
+  case ITER_MAP: {
+    PullResult status = pullIterator(AS_ITERATOR(iterator->source), value);
+    if (status != PULL_VALUE)
+      return status;
+    push(iterator->argument);
+    push(*value);
+    return callFromNative(1, value) ? PULL_VALUE : PULL_ERROR;
+  }
+  case ITER_FILTER:
+    for (;;) {
+      PullResult status = pullIterator(AS_ITERATOR(iterator->source), value);
+      if (status != PULL_VALUE)
+        return status;
+      push(*value);
+      push(iterator->argument);
+      push(*value);
+      Value keep;
+      if (!callFromNative(1, &keep)) {
+        *value = keep;
+        return PULL_ERROR;
+      }
+      pop();
+      if (!isFalsey(keep))
+        return PULL_VALUE;
+    }
+  case ITER_TAKE: {
+    if (iterator->position >= iterator->limit)
+      return PULL_DONE;
+    PullResult status = pullIterator(AS_ITERATOR(iterator->source), value);
+    if (status == PULL_VALUE)
+      iterator->position++;
+    return status;
+  }
+  case ITER_ZIP: {
+    PullResult status = pullIterator(AS_ITERATOR(iterator->source), value);
+    if (status != PULL_VALUE)
+      return status;
+    push(*value);
+    status = pullIterator(AS_ITERATOR(iterator->argument), value);
+    if (status == PULL_ERROR)
+      return status;
+    if (status == PULL_DONE) {
+      pop();
+      return status;
+    }
+    push(*value);
+    *value = OBJ_VAL(newTuple(vm.stackTop - 2, 2));
+    vm.stackTop -= 2;
+    return PULL_VALUE;
+  }
+  case ITER_ENUMERATE: {
+    PullResult status = pullIterator(AS_ITERATOR(iterator->source), value);
+    if (status != PULL_VALUE)
+      return status;
+    push(NUMBER_VAL(iterator->position++));
+    push(*value);
+    *value = OBJ_VAL(newTuple(vm.stackTop - 2, 2));
+    vm.stackTop -= 2;
+    return PULL_VALUE;
+  }
+  }
+  return PULL_DONE;
+}
+
+// Lists, tuples, strings and vectors start a pipeline wherever an iterator
+// is expected. Strings are walked by character.
+static bool toIterator(Value value, Value *iterator) {
+  if (IS_ITERATOR(value)) {
+    *iterator = value;
+    return true;
+  }
+  if (!IS_LIST(value) && !IS_TUPLE(value) && !IS_STRING(value) &&
+      !IS_VECTOR(value))
+    return false;
+  *iterator = OBJ_VAL(newIterator(ITER_SEQUENCE, value, NIL_VAL));
+  return true;
+}
+
+static ObjIterator *addStage(IteratorKind kind, Value receiver,
+                             Value argument) {
+  Value source;
+  toIterator(receiver, &source);
+  push(source);
+  ObjIterator *stage = newIterator(kind, source, argument);
+  pop();
+  return stage;
+}
+
+static NativeResult iterMethod(int argCount, Value *args) {
+  (void)argCount;
+  Value iterator;
+  toIterator(args[0], &iterator);
+  return NATIVE_SUCCESS(iterator);
+}
+
+static NativeResult mapMethod(int argCount, Value *args) {
+  (void)argCount;
+  return NATIVE_SUCCESS(OBJ_VAL(addStage(ITER_MAP, args[0], args[1])));
+}
+
+static NativeResult filterMethod(int argCount, Value *args) {
+  (void)argCount;
+  return NATIVE_SUCCESS(OBJ_VAL(addStage(ITER_FILTER, args[0], args[1])));
+}
+
+static NativeResult takeMethod(int argCount, Value *args) {
+  (void)argCount;
+  // NaN fails every comparison. Doubles from 2^53 up are all whole and
+  // don't fit the cast.
+  double count = IS_NUMBER(args[1]) ? AS_NUMBER(args[1]) : -1;
+  if (!(count >= 0) ||
+      (count < 9007199254740992.0 && count != (double)(int64_t)count)) {
+    return NATIVE_ERROR("take() count must be a non-negative whole number.");
+  }
+  ObjIterator *stage = addStage(ITER_TAKE, args[0], NIL_VAL);
+  // No pipeline outlasts INT_MAX items, so larger counts take everything.
+  stage->limit = count > INT_MAX ? INT_MAX : (int)count;
+  return NATIVE_SUCCESS(OBJ_VAL(stage));
+}
+
+static NativeResult zipMethod(int argCount, Value *args) {
+  (void)argCount;
+  Value other;
+  if (!toIterator(args[1], &other)) {
+    return NATIVE_ERROR(
+        "zip() takes an iterator, list, tuple, string or vector.");
+  }
+  push(other);
+  ObjIterator *stage = addStage(ITER_ZIP, args[0], other);
+  pop();
+  return NATIVE_SUCCESS(OBJ_VAL(stage));
+}
+
+static NativeResult enumerateMethod(int argCount, Value *args) {
+  (void)argCount;
+  return NATIVE_SUCCESS(OBJ_VAL(addStage(ITER_ENUMERATE, args[0], NIL_VAL)));
+}
+
+static NativeResult toListMethod(int argCount, Value *args) {
+  (void)argCount;
+  ObjList *list = newList();
+  push(OBJ_VAL(list));
+  Value value;
+  PullResult status;
+  while ((status = pullIterator(AS_ITERATOR(args[0]), &value)) ==
+         PULL_VALUE) {
+    push(value);
+    appendToList(list, value);
+    pop();
+  }
+  if (status == PULL_ERROR)
+    return NATIVE_RETHROW(value);
+  return NATIVE_SUCCESS(OBJ_VAL(list));
+}
+
+static NativeResult reduceMethod(int argCount, Value *args) {
+  (void)argCount;
+  // args[2] starts as the initial value and holds the running total.
+  Value value;
+  PullResult status;
+  while ((status = pullIterator(AS_ITERATOR(args[0]), &value)) ==
+         PULL_VALUE) {
+    push(args[1]);
+    push(args[2]);
+    push(value);
+    if (!callFromNative(2, &args[2]))
+      return NATIVE_RETHROW(args[2]);
+  }
+  if (status == PULL_ERROR)
+    return NATIVE_RETHROW(value);
+  return NATIVE_SUCCESS(args[2]);
+}
+
+static NativeResult forEachMethod(int argCount, Value *args) {
+  (void)argCount;
+  Value value;
+  PullResult status;
+  while ((status = pullIterator(AS_ITERATOR(args[0]), &value)) ==
+         PULL_VALUE) {
+    push(args[1]);
+    push(value);
+    if (!callFromNative(1, &value))
+      return NATIVE_RETHROW(value);
+  }
+  if (status == PULL_ERROR)
+    return NATIVE_RETHROW(value);
+  return NATIVE_SUCCESS(NIL_VAL);
+}
+
+// Whether entry a comes out of the queue before entry b: 1 or 0, or -1 if
+// the comparator raised *error.
+static int heapBefore(ObjPriorityQueue *queue, int a, int b, Value *error) {
+  if (IS_NIL(queue->comparator))
+    return queue->entries[a].priority < queue->entries[b].priority;
+
+  push(queue->comparator);
+  push(queue->entries[a].value);
+  push(queue->entries[b].value);
+  Value result;
+  queue->isComparing = true;
+  bool ok = callFromNative(2, &result);
+  queue->isComparing = false;
+  if (!ok) {
+    *error = result;
+    return -1;
+  }
+  return !isFalsey(result);
+}
+
+static void swapEntries(ObjPriorityQueue *queue, int a, int b) {
+  HeapEntry entry = queue->entries[a];
+  queue->entries[a] = queue->entries[b];
+  queue->entries[b] = entry;
+}
+
+// A sift that fails part way leaves the heap out of order, so both sifts
+// record where the entry went and walk it back to where it started. A heap
+// of INT_MAX entries is 31 levels deep.
+#define SIFT_PATH_MAX 32
+
+static void unwindSift(ObjPriorityQueue *queue, int *path, int steps) {
+  for (; steps > 0; steps--) {
+    swapEntries(queue, path[steps], path[steps - 1]);
+  }
+}
+
+static bool siftUp(ObjPriorityQueue *queue, int index, Value *error) {
+  int path[SIFT_PATH_MAX];
+  int steps = 0;
+  path[0] = index;
+  while (index > 0) {
+    int parent = (index - 1) / 2;
+    int before = heapBefore(queue, index, parent, error);
+    if (before == -1) {
+      unwindSift(queue, path, steps);
+      return false;
+    }
+    if (!before)
+      break;
+    swapEntries(queue, index, parent);
+    index = parent;
+    path[++steps] = index;
+  }
+  return true;
+}
+
+static bool siftDown(ObjPriorityQueue *queue, int index, Value *error) {
+  int path[SIFT_PATH_MAX];
+  int steps = 0;
+  path[0] = index;
+  for (;;) {
+    int child = 2 * index + 1;
+    if (child >= queue->count)
+      return true;
+    int before;
+    if (child + 1 < queue->count) {
+      before = heapBefore(queue, child + 1, child, error);
+      if (before == -1)
+        break;
+      child += before;
+    }
+    before = heapBefore(queue, child, index, error);
+    if (before == -1)
+      break;
+    if (!before)
+      return true;
+    swapEntries(queue, index, child);
+    index = child;
+    path[++steps] = index;
+  }
+  unwindSift(queue, path, steps);
+  return false;
+}
+
+static void reserveEntries(ObjPriorityQueue *queue, int count) {
+  if (queue->capacity < count) {
+    int oldCapacity = queue->capacity;
+    queue->capacity = count < GROW_CAPACITY(oldCapacity)
+                          ? GROW_CAPACITY(oldCapacity)
+                          : count;
+    queue->entries = GROW_ARRAY(HeapEntry, queue->entries, oldCapacity,
+                                queue->capacity);
+  }
+}
+
+static bool isCallable(Value value) {
+  if (!IS_OBJ(value))
+    return false;
+  switch (OBJ_TYPE(value)) {
+  case OBJ_BOUND_METHOD:
+  case OBJ_CLASS:
+  case OBJ_CLOSURE:
+  case OBJ_NATIVE:
+  case OBJ_STRUCT_TYPE:
+    return true;
+  default:
+    return false;
+  }
+}
+
+// PriorityQueue(), PriorityQueue(comparator), PriorityQueue(items) or
+// PriorityQueue(items, comparator). Without a comparator, items must be
+// numbers and are their own priorities. Items are heapified in O(n).
+static NativeResult priorityQueueNative(int argCount, Value *args) {
+  Value items = NIL_VAL;
+  Value comparator = NIL_VAL;
+  if (argCount > 2) {
+    return NATIVE_ERROR("PriorityQueue() takes at most 2 arguments.");
+  }
+  if (argCount >= 1 && (IS_LIST(args[0]) || IS_TUPLE(args[0]))) {
+    items = args[0];
+    if (argCount == 2)
+      comparator = args[1];
+  } else if (argCount == 1) {
+    comparator = args[0];
+  } else if (argCount == 2) {
+    return NATIVE_ERROR("PriorityQueue() items must be a list or tuple.");
+  }
+  if (!IS_NIL(comparator) && !isCallable(comparator)) {
+    return NATIVE_ERROR("PriorityQueue() comparator must be callable.");
+  }
+
+  ObjPriorityQueue *queue = newPriorityQueue(comparator);
+  push(OBJ_VAL(queue));
+  int count = IS_NIL(items)    ? 0
+              : IS_LIST(items) ? AS_LIST(items)->count
+                               : AS_TUPLE(items)->count;
+  reserveEntries(queue, count);
+  for (int i = 0; i < count; i++) {
+    Value item = IS_LIST(items) ? indexFromList(AS_LIST(items), i)
+                                : AS_TUPLE(items)->items[i];
+    if (IS_NIL(comparator) && !IS_NUMBER(item)) {
+      return NATIVE_ERROR(
+          "PriorityQueue() items must be numbers without a comparator.");
+    }
+    queue->entries[i].value = item;
+    queue->entries[i].priority = IS_NUMBER(item) ? AS_NUMBER(item) : 0;
+    queue->count++;
+  }
+
+  Value error;
+  for (int i = queue->count / 2 - 1; i >= 0; i--) {
+    if (!siftDown(queue, i, &error))
+      return NATIVE_RETHROW(error);
+  }
+  pop();
+  return NATIVE_SUCCESS(OBJ_VAL(queue));
+}
+
+static NativeResult queuePushMethod(int argCount, Value *args) {
+  // push(value) or push(value, priority); a number is its own priority.
+  ObjPriorityQueue *queue = AS_PRIORITY_QUEUE(args[0]);
+  if (queue->isComparing) {
+    return NATIVE_ERROR("Can't change a priority queue from its comparator.");
+  }
+  double priority = 0;
+  if (IS_NIL(queue->comparator)) {
+    if (argCount != 2 && argCount != 3) {
+      return NATIVE_ERROR("push() takes a value and an optional priority.");
+    }
+    Value given = argCount == 3 ? args[2] : args[1];
+    if (!IS_NUMBER(given)) {
+      return NATIVE_ERROR("Priority must be a number.");
+    }
+    priority = AS_NUMBER(given);
+  } else if (argCount != 2) {
+    return NATIVE_ERROR(
+        "push() takes only a value when the queue has a comparator.");
+  }
+
+  reserveEntries(queue, queue->count + 1);
+  queue->entries[queue->count].value = args[1];
+  queue->entries[queue->count].priority = priority;
+  queue->count++;
+  Value error;
+  if (!siftUp(queue, queue->count - 1, &error)) {
+    // The new entry is back at the end, so dropping it undoes the push.
+    queue->count--;
+    return NATIVE_RETHROW(error);
+  }
+  return NATIVE_SUCCESS(NIL_VAL);
+}
+
+static NativeResult queuePopMethod(int argCount, Value *args) {
+  (void)argCount;
+  ObjPriorityQueue *queue = AS_PRIORITY_QUEUE(args[0]);
+  if (queue->isComparing) {
+    return NATIVE_ERROR("Can't change a priority queue from its comparator.");
+  }
+  if (queue->count == 0) {
+    return NATIVE_ERROR("pop() from an empty priority queue.");
+  }
+  HeapEntry top = queue->entries[0];
+  queue->entries[0] = queue->entries[--queue->count];
+
+  push(top.value);
+  Value error;
+  if (!siftDown(queue, 0, &error)) {
+    // The moved entry is back at the root; return it to the end.
+    queue->entries[queue->count++] = queue->entries[0];
+    queue->entries[0] = top;
+    return NATIVE_RETHROW(error);
+  }
+  pop();
+  return NATIVE_SUCCESS(top.value);
+}
+
+static NativeResult queuePeekMethod(int argCount, Value *args) {
+  (void)argCount;
+  ObjPriorityQueue *queue = AS_PRIORITY_QUEUE(args[0]);
+  if (queue->count == 0) {
+    return NATIVE_ERROR("peek() at an empty priority queue.");
+  }
+  return NATIVE_SUCCESS(queue->entries[0].value);
+}
+
+static NativeResult queueLenMethod(int argCount, Value *args) {
+  (void)argCount;
+  return NATIVE_SUCCESS(NUMBER_VAL(AS_PRIORITY_QUEUE(args[0])->count));
+}
+
+// Vector() or Vector(items) from a list or tuple. The items go into a
+// transient, which becomes persistent once it is full.
+static NativeResult vectorNative(int argCount, Value *args) {
+  if (argCount > 1) {
+    return NATIVE_ERROR("Vector() takes at most 1 argument.");
+  }
+  if (argCount == 1 && !IS_LIST(args[0]) && !IS_TUPLE(args[0])) {
+    return NATIVE_ERROR("Vector() items must be a list or tuple.");
+  }
+
+  ObjVector *vector = emptyVector(newEditToken());
+  push(OBJ_VAL(vector));
+  int count = argCount == 0       ? 0
+              : IS_LIST(args[0]) ? AS_LIST(args[0])->count
+                                 : AS_TUPLE(args[0])->count;
+  for (int i = 0; i < count; i++) {
+    Value item = IS_LIST(args[0]) ? indexFromList(AS_LIST(args[0]), i)
+                                  : AS_TUPLE(args[0])->items[i];
+    vectorPush(vector, item);
+  }
+  vector->edit = 0;
+  pop();
+  return NATIVE_SUCCESS(OBJ_VAL(vector));
+}
+
+static bool vectorIndex(ObjVector *vector, Value value, int *index) {
+  if (!IS_NUMBER(value))
+    return false;
+  *index = AS_NUMBER(value);
+  return *index >= 0 && *index < vector->count;
+}
+
+static NativeResult vectorLenMethod(int argCount, Value *args) {
+  (void)argCount;
+  return NATIVE_SUCCESS(NUMBER_VAL(AS_VECTOR(args[0])->count));
+}
+
+static NativeResult vectorGetMethod(int argCount, Value *args) {
+  (void)argCount;
+  int index;
+  if (!vectorIndex(AS_VECTOR(args[0]), args[1], &index)) {
+    return NATIVE_ERROR("Vector index out of range.");
+  }
+  return NATIVE_SUCCESS(vectorGet(AS_VECTOR(args[0]), index));
+}
+
+static NativeResult vectorSetMethod(int argCount, Value *args) {
+  (void)argCount;
+  int index;
+  if (!vectorIndex(AS_VECTOR(args[0]), args[1], &index)) {
+    return NATIVE_ERROR("Vector index out of range.");
+  }
+  return NATIVE_SUCCESS(
+      OBJ_VAL(vectorSet(AS_VECTOR(args[0]), index, args[2])));
+}
+
+static NativeResult vectorPushMethod(int argCount, Value *args) {
+  (void)argCount;
+  return NATIVE_SUCCESS(OBJ_VAL(vectorPush(AS_VECTOR(args[0]), args[1])));
+}
+
+static NativeResult vectorPopMethod(int argCount, Value *args) {
+  (void)argCount;
+  if (AS_VECTOR(args[0])->count == 0) {
+    return NATIVE_ERROR("pop() from an empty vector.");
+  }
+  return NATIVE_SUCCESS(OBJ_VAL(vectorPop(AS_VECTOR(args[0]))));
+}
+
+static NativeResult vectorToListMethod(int argCount, Value *args) {
+  (void)argCount;
+  ObjVector *vector = AS_VECTOR(args[0]);
+  ObjList *list = newList();
+  push(OBJ_VAL(list));
+  for (int i = 0; i < vector->count; i++) {
+    appendToList(list, vectorGet(vector, i));
+  }
+  pop();
+  return NATIVE_SUCCESS(OBJ_VAL(list));
+}
+
+// A transient shares the vector's nodes and copies each one the first time
+// it changes it; after that it changes its own copies in place.
+static NativeResult vectorTransientMethod(int argCount, Value *args) {
+  (void)argCount;
+  ObjVector *vector = AS_VECTOR(args[0]);
+  if (vector->edit != 0) {
+    return NATIVE_ERROR("Vector is already transient.");
+  }
+  return NATIVE_SUCCESS(OBJ_VAL(newVector(vector->root, vector->tail,
+                                          vector->count, vector->shift,
+                                          newEditToken())));
+}
+
+// Retiring the edit token freezes every node the transient made.
+static NativeResult vectorPersistentMethod(int argCount, Value *args) {
+  (void)argCount;
+  AS_VECTOR(args[0])->edit = 0;
+  return NATIVE_SUCCESS(args[0]);
+}
+
+// Map() or Map(items) from a list or tuple of (key, value) tuples.
+static NativeResult mapNative(int argCount, Value *args) {
+  if (argCount > 1) {
+    return NATIVE_ERROR("Map() takes at most 1 argument.");
+  }
+  if (argCount == 1 && !IS_LIST(args[0]) && !IS_TUPLE(args[0])) {
+    return NATIVE_ERROR("Map() items must be a list or tuple.");
+  }
+
+  ObjMap *map = emptyMap(newEditToken());
+  push(OBJ_VAL(map));
+  int count = argCount == 0       ? 0
+              : IS_LIST(args[0]) ? AS_LIST(args[0])->count
+                                 : AS_TUPLE(args[0])->count;
+  for (int i = 0; i < count; i++) {
+    Value item = IS_LIST(args[0]) ? indexFromList(AS_LIST(args[0]), i)
+                                  : AS_TUPLE(args[0])->items[i];
+    if (!IS_TUPLE(item) || AS_TUPLE(item)->count != 2) {
+      return NATIVE_ERROR("Map() items must be (key, value) tuples.");
+    }
+    mapSet(map, AS_TUPLE(item)->items[0], AS_TUPLE(item)->items[1]);
+  }
+  map->edit = 0;
+  pop();
+  return NATIVE_SUCCESS(OBJ_VAL(map));
+}
+
+static NativeResult mapLenMethod(int argCount, Value *args) {
+  (void)argCount;
+  return NATIVE_SUCCESS(NUMBER_VAL(AS_MAP(args[0])->count));
+}
+
+// get(key) or get(key, default); a missing key gives the default or nil.
+static NativeResult mapGetMethod(int argCount, Value *args) {
+  if (argCount != 2 && argCount != 3) {
+    return NATIVE_ERROR("get() takes a key and an optional default.");
+  }
+  Value value;
+  if (!mapGet(AS_MAP(args[0]), args[1], &value)) {
+    value = argCount == 3 ? args[2] : NIL_VAL;
+  }
+  return NATIVE_SUCCESS(value);
+}
+
+static NativeResult mapHasMethod(int argCount, Value *args) {
+  (void)argCount;
+  Value value;
+  return NATIVE_SUCCESS(BOOL_VAL(mapGet(AS_MAP(args[0]), args[1], &value)));
+}
+
+static NativeResult mapSetMethod(int argCount, Value *args) {
+  (void)argCount;
+  return NATIVE_SUCCESS(OBJ_VAL(mapSet(AS_MAP(args[0]), args[1], args[2])));
+}
+
+static NativeResult mapDeleteMethod(int argCount, Value *args) {
+  (void)argCount;
+  return NATIVE_SUCCESS(OBJ_VAL(mapDelete(AS_MAP(args[0]), args[1])));
+}
+
+static NativeResult mapKeysMethod(int argCount, Value *args) {
+  (void)argCount;
+  ObjList *keys = newList();
+  push(OBJ_VAL(keys));
+  mapEntries(AS_MAP(args[0]), keys, NULL);
+  pop();
+  return NATIVE_SUCCESS(OBJ_VAL(keys));
+}
+
+static NativeResult mapValuesMethod(int argCount, Value *args) {
+  (void)argCount;
+  ObjList *values = newList();
+  push(OBJ_VAL(values));
+  mapEntries(AS_MAP(args[0]), NULL, values);
+  pop();
+  return NATIVE_SUCCESS(OBJ_VAL(values));
+}
+
+static NativeResult mapTransientMethod(int argCount, Value *args) {
+  (void)argCount;
+  ObjMap *map = AS_MAP(args[0]);
+  if (map->edit != 0) {
+    return NATIVE_ERROR("Map is already transient.");
+  }
+  return NATIVE_SUCCESS(
+      OBJ_VAL(newMap(map->root, map->count, newEditToken())));
+}
+
+static NativeResult mapPersistentMethod(int argCount, Value *args) {
+  (void)argCount;
+  AS_MAP(args[0])->edit = 0;
+  return NATIVE_SUCCESS(args[0]);
+}
+
 static void defineNative(const char *name, NativeFn function, int arity) {
   push(OBJ_VAL(copyString(name, (int)strlen(name))));
   push(OBJ_VAL(newNative(function, arity)));
@@ -152,18 +1035,62 @@ static void defineNative(const char *name, NativeFn function, int arity) {
   pop();
 }
 
-void initVM() {
+static void defineBuiltinMethod(Table *methods, const char *name,
+                                NativeFn function, int arity) {
+  push(OBJ_VAL(copyString(name, (int)strlen(name))));
+  push(OBJ_VAL(newNative(function, arity)));
+  tableSet(methods, AS_STRING(vm.stack[0]), vm.stack[1]);
+  pop();
+  pop();
+}
+
+static void defineStageMethods(Table *methods) {
+  defineBuiltinMethod(methods, "map", mapMethod, 1);
+  defineBuiltinMethod(methods, "filter", filterMethod, 1);
+  defineBuiltinMethod(methods, "take", takeMethod, 1);
+  defineBuiltinMethod(methods, "zip", zipMethod, 1);
+  defineBuiltinMethod(methods, "enumerate", enumerateMethod, 0);
+}
+
+void initVM() { initVMWithAllocator(defaultAllocator()); }
+
+void initVMWithAllocator(Allocator allocator) {
+  vm.allocator = allocator;
   resetStack();
   vm.objects = NULL;
+  vm.immortalObjects = NULL;
+  vm.allocatingImmortal = true;
+  vm.largeBlocks = NULL;
+  vm.largeBytes = 0;
   vm.bytesAllocated = 0;
   vm.nextGC = 1024 * 1024;
+  vm.bytesSinceGC = 0;
+
+  vm.promotedCount = 0;
+  vm.promotedCapacity = 0;
+  vm.promoted = NULL;
 
   vm.grayCount = 0;
   vm.grayCapacity = 0;
   vm.grayStack = NULL;
 
+  for (int i = 0; i < BOUND_METHOD_CACHE_SIZE; i++) {
+    vm.boundMethods[i] = NULL;
+  }
+  vm.fuel = -1;
+  atomic_init(&vm.interrupted, false);
+
   initTable(&vm.globals);
+  initTable(&vm.constGlobals);
+  initTable(&vm.globalTypes);
   initTable(&vm.strings);
+  initTable(&vm.listMethods);
+  initTable(&vm.stringMethods);
+  initTable(&vm.tupleMethods);
+  initTable(&vm.iteratorMethods);
+  initTable(&vm.priorityQueueMethods);
+  initTable(&vm.vectorMethods);
+  initTable(&vm.mapMethods);
 
   vm.initString = NULL;
   vm.initString = copyString("init", 4);
@@ -173,15 +1100,109 @@ void initVM() {
   defineNative("println", printlnNative, -1);
   defineNative("append", appendNative, 2);
   defineNative("delete", deleteNative, 2);
+  defineNative("collect", collectNative, 0);
+  defineNative("pauseGC", pauseGCNative, 0);
+  defineNative("resumeGC", resumeGCNative, 0);
+  defineNative("gcAllocated", gcAllocatedNative, 0);
+  defineNative("PriorityQueue", priorityQueueNative, -1);
+  defineNative("Vector", vectorNative, -1);
+  defineNative("Map", mapNative, -1);
+
+  defineBuiltinMethod(&vm.listMethods, "append", listAppendMethod, 1);
+  defineBuiltinMethod(&vm.listMethods, "insert", listInsertMethod, 2);
+  defineBuiltinMethod(&vm.listMethods, "delete", listDeleteMethod, 1);
+  defineBuiltinMethod(&vm.listMethods, "pop", listPopMethod, 0);
+  defineBuiltinMethod(&vm.listMethods, "len", listLenMethod, 0);
+
+  defineBuiltinMethod(&vm.stringMethods, "len", stringLenMethod, 0);
+  defineBuiltinMethod(&vm.stringMethods, "upper", stringUpperMethod, 0);
+  defineBuiltinMethod(&vm.stringMethods, "lower", stringLowerMethod, 0);
+
+  defineBuiltinMethod(&vm.tupleMethods, "len", tupleLenMethod, 0);
+
+  // Lists, tuples and strings start pipelines; only iterators run them.
+  defineBuiltinMethod(&vm.listMethods, "iter", iterMethod, 0);
+  defineBuiltinMethod(&vm.tupleMethods, "iter", iterMethod, 0);
+  defineBuiltinMethod(&vm.stringMethods, "iter", iterMethod, 0);
+  defineStageMethods(&vm.listMethods);
+  defineStageMethods(&vm.tupleMethods);
+  defineStageMethods(&vm.stringMethods);
+  defineStageMethods(&vm.iteratorMethods);
+  defineBuiltinMethod(&vm.iteratorMethods, "toList", toListMethod, 0);
+  defineBuiltinMethod(&vm.iteratorMethods, "reduce", reduceMethod, 2);
+  defineBuiltinMethod(&vm.iteratorMethods, "forEach", forEachMethod, 1);
+
+  defineBuiltinMethod(&vm.priorityQueueMethods, "push", queuePushMethod, -1);
+  defineBuiltinMethod(&vm.priorityQueueMethods, "pop", queuePopMethod, 0);
+  defineBuiltinMethod(&vm.priorityQueueMethods, "peek", queuePeekMethod, 0);
+  defineBuiltinMethod(&vm.priorityQueueMethods, "len", queueLenMethod, 0);
+
+  defineBuiltinMethod(&vm.vectorMethods, "len", vectorLenMethod, 0);
+  defineBuiltinMethod(&vm.vectorMethods, "get", vectorGetMethod, 1);
+  defineBuiltinMethod(&vm.vectorMethods, "set", vectorSetMethod, 2);
+  defineBuiltinMethod(&vm.vectorMethods, "push", vectorPushMethod, 1);
+  defineBuiltinMethod(&vm.vectorMethods, "pop", vectorPopMethod, 0);
+  defineBuiltinMethod(&vm.vectorMethods, "toList", vectorToListMethod, 0);
+  defineBuiltinMethod(&vm.vectorMethods, "transient", vectorTransientMethod,
+                      0);
+  defineBuiltinMethod(&vm.vectorMethods, "persistent", vectorPersistentMethod,
+                      0);
+  defineBuiltinMethod(&vm.vectorMethods, "iter", iterMethod, 0);
+  defineStageMethods(&vm.vectorMethods);
+
+  defineBuiltinMethod(&vm.mapMethods, "len", mapLenMethod, 0);
+  defineBuiltinMethod(&vm.mapMethods, "get", mapGetMethod, -1);
+  defineBuiltinMethod(&vm.mapMethods, "has", mapHasMethod, 1);
+  defineBuiltinMethod(&vm.mapMethods, "set", mapSetMethod, 2);
+  defineBuiltinMethod(&vm.mapMethods, "delete", mapDeleteMethod, 1);
+  defineBuiltinMethod(&vm.mapMethods, "keys", mapKeysMethod, 0);
+  defineBuiltinMethod(&vm.mapMethods, "values", mapValuesMethod, 0);
+  defineBuiltinMethod(&vm.mapMethods, "transient", mapTransientMethod, 0);
+  defineBuiltinMethod(&vm.mapMethods, "persistent", mapPersistentMethod, 0);
+  vm.allocatingImmortal = false;
 }
 
 void freeVM() {
   freeTable(&vm.globals);
+  freeTable(&vm.constGlobals);
+  freeTable(&vm.globalTypes);
   freeTable(&vm.strings);
+  freeTable(&vm.listMethods);
+  freeTable(&vm.stringMethods);
+  freeTable(&vm.tupleMethods);
+  freeTable(&vm.iteratorMethods);
+  freeTable(&vm.priorityQueueMethods);
+  freeTable(&vm.vectorMethods);
+  freeTable(&vm.mapMethods);
   vm.initString = NULL;
+  freeDebugger();
   freeObjects();
 }
 
+void setFuel(int64_t fuel) {
+  // Zero or less lifts the limit.
+  vm.fuel = fuel > 0 ? fuel : -1;
+}
+
+void interruptVM() {
+  atomic_store_explicit(&vm.interrupted, true, memory_order_relaxed);
+}
+
+void clearInterrupt() {
+  atomic_store_explicit(&vm.interrupted, false, memory_order_relaxed);
+}
+
+static void preempt() {
+  // Both conditions stick, so a script that catches the error can clean up
+  // but can't loop or call its way back into running.
+  if (atomic_load_explicit(&vm.interrupted, memory_order_relaxed)) {
+    runtimeError("Execution interrupted.");
+  } else {
+    vm.fuel = 1;
+    runtimeError("Out of fuel.");
+  }
+}
+
 void push(Value value) {
   *vm.stackTop = value;
   vm.stackTop++;
@@ -228,9 +1249,8 @@ static inline bool callValue(Value callee, int argCount) {
   case OBJ_CLASS: {
     ObjClass *klass = AS_CLASS(callee);
     vm.stackTop[-argCount - 1] = OBJ_VAL(newInstance(klass));
-    Value initializer;
-    if (tableGet(&klass->methods, vm.initString, &initializer)) {
-      return call(AS_CLOSURE(initializer), argCount);
+    if (!IS_NIL(klass->initializer)) {
+      return call(AS_CLOSURE(klass->initializer), argCount);
     } else if (argCount != 0) {
       runtimeError("Expected 0 arguments but got %d", argCount);
       return false;
@@ -240,6 +1260,19 @@ static inline bool callValue(Value callee, int argCount) {
   case OBJ_CLOSURE: {
     return call(AS_CLOSURE(callee), argCount);
   }
+  case OBJ_STRUCT_TYPE: {
+    // Struct constructors take every field positionally.
+    ObjStructType *type = AS_STRUCT_TYPE(callee);
+    if (argCount != type->fieldCount) {
+      runtimeError("Expected %d arguments but got %d", type->fieldCount,
+                   argCount);
+      return false;
+    }
+    ObjStruct *object = newStruct(type, vm.stackTop - argCount);
+    vm.stackTop -= argCount + 1;
+    push(OBJ_VAL(object));
+    return true;
+  }
   case OBJ_NATIVE: {
     ObjNative *native = AS_NATIVE(callee);
 
@@ -251,7 +1284,7 @@ static inline bool callValue(Value callee, int argCount) {
     NativeResult result = native->function(argCount, vm.stackTop - argCount);
 
     if (result.isError) {
-      runtimeError("Native error: %s", AS_CSTRING(result.result));
+      nativeError(result.result);
       return false;
     }
 
@@ -276,10 +1309,52 @@ static bool invokeFromClass(ObjClass *klass, ObjString *name, int argCount) {
   return call(AS_CLOSURE(method), argCount);
 }
 
+static bool invokeBuiltin(Table *methods, ObjString *name, int argCount) {
+  Value method;
+  if (!tableGet(methods, name, &method)) {
+    runtimeError("Undefined method '%s'.", name->chars);
+    return false;
+  }
+
+  ObjNative *native = AS_NATIVE(method);
+  if (native->arity != -1 && native->arity != argCount) {
+    runtimeError("Expected %d arguments but got %d", native->arity, argCount);
+    return false;
+  }
+
+  // Call straight into C with the receiver as args[0], so there is no bound
+  // method to allocate and no global to look up.
+  Value *args = vm.stackTop - argCount - 1;
+  NativeResult result = native->function(argCount + 1, args);
+
+  if (result.isError) {
+    nativeError(result.result);
+    return false;
+  }
+
+  vm.stackTop = args;
+  push(result.result);
+  return true;
+}
+
 static bool invoke(ObjString *name, int argCount) {
   Value receiver = peek(argCount);
-  if (!IS_INSTANCE(receiver)) {
-    runtimeError("Only instances have methods.");
+  if (IS_LIST(receiver)) {
+    return invokeBuiltin(&vm.listMethods, name, argCount);
+  } else if (IS_STRING(receiver)) {
+    return invokeBuiltin(&vm.stringMethods, name, argCount);
+  } else if (IS_TUPLE(receiver)) {
+    return invokeBuiltin(&vm.tupleMethods, name, argCount);
+  } else if (IS_ITERATOR(receiver)) {
+    return invokeBuiltin(&vm.iteratorMethods, name, argCount);
+  } else if (IS_PRIORITY_QUEUE(receiver)) {
+    return invokeBuiltin(&vm.priorityQueueMethods, name, argCount);
+  } else if (IS_VECTOR(receiver)) {
+    return invokeBuiltin(&vm.vectorMethods, name, argCount);
+  } else if (IS_MAP(receiver)) {
+    return invokeBuiltin(&vm.mapMethods, name, argCount);
+  } else if (!IS_INSTANCE(receiver)) {
+    runtimeError("Only instances and built-in collections have methods.");
     return false;
   }
   ObjInstance *instance = AS_INSTANCE(receiver);
@@ -292,6 +1367,24 @@ static bool invoke(ObjString *name, int argCount) {
   return invokeFromClass(instance->klass, name, argCount);
 }
 
+static ObjBoundMethod *cachedBoundMethod(Value receiver, ObjClosure *method) {
+  uintptr_t hash = ((uintptr_t)AS_OBJ(receiver) >> 4) * 31 +
+                   ((uintptr_t)method >> 4);
+  ObjBoundMethod **slot =
+      &vm.boundMethods[hash & (BOUND_METHOD_CACHE_SIZE - 1)];
+
+  // Bound methods are immutable, so rebinding the same method to the same
+  // receiver can hand back the previous one instead of allocating.
+  if (*slot != NULL && (*slot)->method == method &&
+      valuesEqual((*slot)->receiver, receiver)) {
+    return *slot;
+  }
+
+  ObjBoundMethod *bound = newBoundMethod(receiver, method);
+  *slot = bound;
+  return bound;
+}
+
 static bool bindMethod(ObjClass *klass, ObjString *name) {
   Value method;
   if (!tableGet(&klass->methods, name, &method)) {
@@ -299,12 +1392,103 @@ static bool bindMethod(ObjClass *klass, ObjString *name) {
     return false;
   }
 
-  ObjBoundMethod *bound = newBoundMethod(peek(0), AS_CLOSURE(method));
+  ObjBoundMethod *bound = cachedBoundMethod(peek(0), AS_CLOSURE(method));
   pop();
   push(OBJ_VAL(bound));
   return true;
 }
 
+static bool getProperty(ObjString *name) {
+  // Stack before: [receiver] and after: [value]
+  Value receiver = peek(0);
+  if (IS_STRUCT(receiver)) {
+    ObjStruct *object = AS_STRUCT(receiver);
+    int index = structFieldIndex(object->type, name);
+    if (index == -1) {
+      runtimeError("Undefined field '%s'.", name->chars);
+      return false;
+    }
+    vm.stackTop[-1] = object->fields[index];
+    return true;
+  }
+
+  if (!IS_INSTANCE(receiver)) {
+    runtimeError("Only instances have properties.");
+    return false;
+  }
+  ObjInstance *instance = AS_INSTANCE(receiver);
+
+  Value value;
+  if (tableGet(&instance->fields, name, &value)) {
+    pop(); // Instance.
+    push(value);
+    return true;
+  }
+
+  return bindMethod(instance->klass, name);
+}
+
+// Fields added outside an initializer only grow the class's presize hint
+// this far, so one instance used as a dictionary can't inflate every later
+// instance of its class.
+#define PRESIZE_OUTSIDE_INIT_MAX 8
+
+static bool inInitializerOf(ObjInstance *instance) {
+  CallFrame *frame = &vm.frames[vm.frameCount - 1];
+  return frame->closure->function->name == vm.initString &&
+         IS_INSTANCE(frame->slots[0]) &&
+         AS_INSTANCE(frame->slots[0]) == instance;
+}
+
+static bool storeField(Value *receiver, ObjString *name, int index) {
+  // Stores the value on top of the stack in the receiver's field, trying the
+  // compiler's offset before looking the name up. A struct never changes, so
+  // the receiver slot gets an updated copy instead.
+  if (IS_STRUCT(*receiver)) {
+    ObjStruct *object = AS_STRUCT(*receiver);
+    if (index >= object->fieldCount ||
+        object->type->fieldNames[index] != name) {
+      index = structFieldIndex(object->type, name);
+    }
+    if (index == -1) {
+      runtimeError("Struct '%s' has no field '%s'.",
+                   object->type->name->chars, name->chars);
+      return false;
+    }
+    *receiver = OBJ_VAL(structWithField(object, index, peek(0)));
+  } else if (IS_INSTANCE(*receiver)) {
+    ObjInstance *instance = AS_INSTANCE(*receiver);
+    if (tableSet(&instance->fields, name, peek(0)) &&
+        instance->fields.count > instance->klass->fieldCount &&
+        (instance->fields.count <= PRESIZE_OUTSIDE_INIT_MAX ||
+         inInitializerOf(instance))) {
+      instance->klass->fieldCount = instance->fields.count;
+    }
+  } else {
+    runtimeError("Only instances have fields.");
+    return false;
+  }
+  return true;
+}
+
+static bool setProperty(ObjString *name) {
+  // Stack before: [receiver, value] and after: [value]
+  if (IS_STRUCT(peek(1))) {
+    // The updated copy would be lost; OP_SET_FIELD is used where the
+    // receiver can be stored back.
+    runtimeError("Can only assign a struct field through a variable.");
+    return false;
+  }
+  if (!storeField(&vm.stackTop[-2], name, UINT8_MAX)) {
+    return false;
+  }
+
+  Value value = pop();
+  pop();
+  push(value);
+  return true;
+}
+
 static ObjUpvalue *captureUpvalue(Value *local) {
   ObjUpvalue *prevUpvalue = NULL;
   ObjUpvalue *upvalue = vm.openUpvalues;
@@ -340,27 +1524,144 @@ static void defineMethod(ObjString *name) {
   Value method = peek(0);
   ObjClass *klass = AS_CLASS(peek(1));
   tableSet(&klass->methods, name, method);
+  if (name == vm.initString) {
+    klass->initializer = method;
+  }
   pop();
 }
 
+static bool hasStaticType(Value value, StaticType type) {
+  switch (type) {
+  case STATIC_NUMBER:
+    return IS_NUMBER(value);
+  case STATIC_STRING:
+    return IS_STRING(value);
+  case STATIC_BOOL:
+    return IS_BOOL(value);
+  default:
+    return true;
+  }
+}
+
 static bool isFalsey(Value value) {
   return IS_NIL(value) || (IS_BOOL(value) && !AS_BOOL(value));
 }
 
-static void concatenate() {
-  ObjString *b = AS_STRING(peek(0));
-  ObjString *a = AS_STRING(peek(1));
-
+static ObjString *concatenateStrings(ObjString *a, ObjString *b) {
+  // Expects a and b are already trackable by GC.
   int length = a->length + b->length;
   char *chars = ALLOCATE(char, length + 1);
   memcpy(chars, a->chars, a->length);
   memcpy(chars + a->length, b->chars, b->length);
   chars[length] = '\0';
 
-  ObjString *result = takeString(chars, length);
+  return takeString(chars, length);
+}
+
+static void concatenate() {
+  ObjString *b = AS_STRING(peek(0));
+  ObjString *a = AS_STRING(peek(1));
+
+  ObjString *result = concatenateStrings(a, b);
+  pop();
+  pop();
+  push(OBJ_VAL(result));
+}
+
+static bool stringContains(ObjString *string, ObjString *part) {
+  if (part->length > string->length)
+    return false;
+  if (part->length == 0)
+    return true;
+  const char *last = string->chars + string->length - part->length;
+  for (const char *start = string->chars; start <= last; start++) {
+    start = memchr(start, part->chars[0], last - start + 1);
+    if (start == NULL)
+      return false;
+    if (memcmp(start, part->chars, part->length) == 0)
+      return true;
+  }
+  return false;
+}
+
+static bool repeatCount(ObjList *list, Value times, int *count) {
+  // A negative count gives an empty list.
+  if (!IS_NUMBER(times))
+    return false;
+  double n = AS_NUMBER(times) < 0 ? 0 : AS_NUMBER(times);
+  if (!(n <= INT_MAX) || n != (int)n)
+    return false;
+  *count = (int)n;
+  return (double)list->count * *count <= INT_MAX;
+}
+
+static bool repeat() {
+  // A list times a count, either way round, repeats the list.
+  Value list = IS_LIST(peek(1)) ? peek(1) : peek(0);
+  Value times = IS_LIST(peek(1)) ? peek(0) : peek(1);
+  int count;
+  if (!IS_LIST(list) || !IS_NUMBER(times)) {
+    runtimeError("Operands must be numbers.");
+    return false;
+  }
+  if (!repeatCount(AS_LIST(list), times, &count)) {
+    runtimeError("A list can only be repeated a whole number of times.");
+    return false;
+  }
+
+  ObjList *result = repeatList(AS_LIST(list), count);
   pop();
   pop();
   push(OBJ_VAL(result));
+  return true;
+}
+
+static bool compoundValue(uint8_t op, Value a, Value b, Value *result) {
+  // Applies the arithmetic opcode op to a and b for the OP_COMPOUND_*
+  // instructions. Returns false if the operand types don't fit the operator.
+  if (IS_NUMBER(a) && IS_NUMBER(b)) {
+    switch (op) {
+    case OP_ADD:
+      *result = NUMBER_VAL(AS_NUMBER(a) + AS_NUMBER(b));
+      return true;
+    case OP_SUBTRACT:
+      *result = NUMBER_VAL(AS_NUMBER(a) - AS_NUMBER(b));
+      return true;
+    case OP_MULTIPLY:
+      *result = NUMBER_VAL(AS_NUMBER(a) * AS_NUMBER(b));
+      return true;
+    case OP_DIVIDE:
+      *result = NUMBER_VAL(AS_NUMBER(a) / AS_NUMBER(b));
+      return true;
+    }
+  } else if (op == OP_ADD && IS_STRING(a) && IS_STRING(b)) {
+    *result = OBJ_VAL(concatenateStrings(AS_STRING(a), AS_STRING(b)));
+    return true;
+  } else if (op == OP_ADD && IS_LIST(a) && IS_LIST(b)) {
+    *result = OBJ_VAL(concatenateLists(AS_LIST(a), AS_LIST(b)));
+    return true;
+  } else if (op == OP_MULTIPLY && IS_LIST(a)) {
+    int count;
+    if (!repeatCount(AS_LIST(a), b, &count))
+      return false;
+    *result = OBJ_VAL(repeatList(AS_LIST(a), count));
+    return true;
+  }
+  return false;
+}
+
+static void deoptimizeLoop(Chunk *chunk, int guard, int end) {
+  // The loop guard at guard found something other than a list, so every
+  // unchecked subscript up to end goes back to its checked form for good.
+  for (int offset = guard + 5; offset < end;
+       offset += instructionLength(chunk, offset)) {
+    if (chunk->code[offset] == OP_INDEX_LIST) {
+      chunk->code[offset] = OP_INDEX_SUBSCR;
+    } else if (chunk->code[offset] == OP_STORE_LIST) {
+      chunk->code[offset] = OP_STORE_SUBSCR;
+    }
+  }
+  clearLoopGuard(chunk, guard);
 }
 
 static InterpretResult run() {
@@ -394,6 +1695,66 @@ static InterpretResult run() {
         NUMBER_VAL(AS_NUMBER(vm.stackTop[-2]) op AS_NUMBER(vm.stackTop[-1]));  \
     vm.stackTop--; /* Adjust stack pointer */                                  \
   } while (false)
+#ifdef DEBUG_VERIFY_TYPES
+#define VERIFY_NUMBERS(count)                                                  \
+  do {                                                                         \
+    for (int i = 0; i < (count); i++) {                                        \
+      if (!IS_NUMBER(peek(i))) {                                               \
+        frame->ip = ip;                                                        \
+        runtimeError("Inferred type violated: operand is not a number.");     \
+        return INTERPRET_RUNTIME_ERROR;                                        \
+      }                                                                        \
+    }                                                                          \
+  } while (false)
+// The list and index sit below depth other values.
+#define VERIFY_LIST_INDEX(depth)                                               \
+  do {                                                                         \
+    if (!IS_LIST(peek((depth) + 1)) || !IS_NUMBER(peek(depth)) ||              \
+        !isValidListIndex(AS_LIST(peek((depth) + 1)),                          \
+                          (int)AS_NUMBER(peek(depth)))) {                      \
+      frame->ip = ip;                                                          \
+      runtimeError("Loop guard violated: unchecked subscript out of range.");  \
+      return INTERPRET_RUNTIME_ERROR;                                          \
+    }                                                                          \
+  } while (false)
+#else
+#define VERIFY_NUMBERS(count)
+#define VERIFY_LIST_INDEX(depth)
+#endif
+#define UNCHECKED_BINARY_OP(valueType, op)                                     \
+  do {                                                                         \
+    /* The compiler proved both operands are numbers. */                      \
+    VERIFY_NUMBERS(2);                                                         \
+    vm.stackTop[-2] =                                                          \
+        valueType(AS_NUMBER(vm.stackTop[-2]) op AS_NUMBER(vm.stackTop[-1]));   \
+    vm.stackTop--;                                                             \
+  } while (false)
+#define CONSUME_FUEL()                                                         \
+  do {                                                                         \
+    if (--vm.fuel == 0 ||                                                      \
+        atomic_load_explicit(&vm.interrupted, memory_order_relaxed)) {         \
+      frame->ip = ip;                                                          \
+      preempt();                                                               \
+      return INTERPRET_RUNTIME_ERROR;                                          \
+    }                                                                          \
+  } while (false)
+#define COMPOUND_ASSIGN(target, operands)                                      \
+  do {                                                                         \
+    /* Stack before: [operands..., rhs] and after: [new or old value] */      \
+    uint8_t op = READ_BYTE() & ~COMPOUND_UPDATE;                               \
+    Value old = *(target);                                                     \
+    Value result;                                                              \
+    if (!compoundValue(op & ~COMPOUND_POSTFIX, old, peek(0), &result)) {       \
+      frame->ip = ip;                                                          \
+      runtimeError((op & ~COMPOUND_POSTFIX) == OP_ADD                          \
+                       ? "Operands must be two numbers, strings or lists."     \
+                       : "Operands must be numbers.");                         \
+      return INTERPRET_RUNTIME_ERROR;                                          \
+    }                                                                          \
+    *(target) = result;                                                        \
+    vm.stackTop -= (operands);                                                 \
+    vm.stackTop[-1] = (op & COMPOUND_POSTFIX) ? old : result;                  \
+  } while (false)
   for (;;) {
 
 #ifdef DEBUG_TRACE_EXECUTION
@@ -409,8 +1770,9 @@ static InterpretResult run() {
         &frame->closure->function->chunk,
         (int)(frame->ip - frame->closure->function->chunk.code));
 #endif
-    uint8_t instruction;
-    switch (instruction = READ_BYTE()) {
+    uint8_t instruction = READ_BYTE();
+  dispatch:
+    switch (instruction) {
     case OP_CONSTANT: {
       Value constant = READ_CONSTANT();
       push(constant);
@@ -478,36 +1840,181 @@ static InterpretResult run() {
       *frame->closure->upvalues[slot]->location = peek(0);
       break;
     }
-    case OP_GET_PROPERTY: {
-      if (!IS_INSTANCE(peek(0))) {
-        runtimeError("Only instances have properties.");
+    case OP_COMPOUND_LOCAL: {
+      uint8_t slot = READ_BYTE();
+      COMPOUND_ASSIGN(&frame->slots[slot], 0);
+      break;
+    }
+    case OP_COMPOUND_GLOBAL: {
+      ObjString *name = READ_STRING();
+      Value *value = tableGetRef(&vm.globals, name);
+      if (value == NULL) {
+        frame->ip = ip;
+        runtimeError("Undefined variable '%s'.", name->chars);
         return INTERPRET_RUNTIME_ERROR;
       }
-      ObjInstance *instance = AS_INSTANCE(peek(0));
+      COMPOUND_ASSIGN(value, 0);
+      break;
+    }
+    case OP_COMPOUND_UPVALUE: {
+      uint8_t slot = READ_BYTE();
+      COMPOUND_ASSIGN(frame->closure->upvalues[slot]->location, 0);
+      break;
+    }
+    case OP_COMPOUND_PROPERTY: {
+      // Stack before: [instance, rhs] and after: [value], or with
+      // COMPOUND_UPDATE [value, instance] for the compiler to store back.
       ObjString *name = READ_STRING();
-
-      Value value;
-      if (tableGet(&instance->fields, name, &value)) {
-        pop(); // Instance.
-        push(value);
+      Value receiver = peek(1);
+      bool update = (*ip & COMPOUND_UPDATE) != 0;
+      if (IS_STRUCT(receiver)) {
+        ObjStruct *object = AS_STRUCT(receiver);
+        int index = structFieldIndex(object->type, name);
+        if (index == -1) {
+          frame->ip = ip;
+          runtimeError("Undefined field '%s'.", name->chars);
+          return INTERPRET_RUNTIME_ERROR;
+        }
+        if (!update) {
+          frame->ip = ip;
+          runtimeError("Can only assign a struct field through a variable.");
+          return INTERPRET_RUNTIME_ERROR;
+        }
+        // Stack: [struct, value, new field], keeping all three reachable
+        // while the updated copy is made.
+        Value field = object->fields[index];
+        COMPOUND_ASSIGN(&field, 0);
+        push(field);
+        ObjStruct *copy = structWithField(object, index, field);
+        pop();
+        vm.stackTop[-2] = vm.stackTop[-1];
+        vm.stackTop[-1] = OBJ_VAL(copy);
         break;
       }
+      if (!IS_INSTANCE(receiver)) {
+        frame->ip = ip;
+        runtimeError("Only instances have fields.");
+        return INTERPRET_RUNTIME_ERROR;
+      }
+      Value *value = tableGetRef(&AS_INSTANCE(receiver)->fields, name);
+      if (value == NULL) {
+        frame->ip = ip;
+        runtimeError("Undefined property '%s'.", name->chars);
+        return INTERPRET_RUNTIME_ERROR;
+      }
+      COMPOUND_ASSIGN(value, 1);
+      if (update) {
+        push(receiver);
+      }
+      break;
+    }
+    case OP_COMPOUND_SUBSCR: {
+      // Stack before: [list, index, rhs] and after: [value]
+      if (!IS_LIST(peek(2))) {
+        frame->ip = ip;
+        runtimeError("Cannot store value in a non-list.");
+        return INTERPRET_RUNTIME_ERROR;
+      }
+      ObjList *list = AS_LIST(peek(2));
+
+      if (!IS_NUMBER(peek(1))) {
+        frame->ip = ip;
+        runtimeError("List index is not a number.");
+        return INTERPRET_RUNTIME_ERROR;
+      }
+      int index = AS_NUMBER(peek(1));
 
-      if (!bindMethod(instance->klass, name)) {
+      if (!isValidListIndex(list, index)) {
+        frame->ip = ip;
+        runtimeError("Invalid list index.");
+        return INTERPRET_RUNTIME_ERROR;
+      }
+      if (list->kind == LIST_NUMBERS) {
+        // Arithmetic on a number only ever yields a number, so the list
+        // keeps its kind.
+        Value item = NUMBER_VAL(list->numbers[index]);
+        COMPOUND_ASSIGN(&item, 2);
+        list->numbers[index] = AS_NUMBER(item);
+      } else {
+        COMPOUND_ASSIGN(&list->items[index], 2);
+      }
+      break;
+    }
+    case OP_GET_PROPERTY: {
+      ObjString *name = READ_STRING();
+      frame->ip = ip;
+      if (!getProperty(name)) {
         return INTERPRET_RUNTIME_ERROR;
       }
       break;
     }
     case OP_SET_PROPERTY: {
-      if (!IS_INSTANCE(peek(1))) {
-        runtimeError("Only instances have fields.");
+      ObjString *name = READ_STRING();
+      frame->ip = ip;
+      if (!setProperty(name)) {
+        return INTERPRET_RUNTIME_ERROR;
+      }
+      break;
+    }
+    case OP_GET_FIELD: {
+      // Stack before: [receiver] and after: [value]
+      // The offset comes from the compiler and is checked against the
+      // receiver's type, falling back to a by-name lookup if it doesn't fit.
+      ObjString *name = READ_STRING();
+      uint8_t index = READ_BYTE();
+      if (IS_STRUCT(peek(0))) {
+        ObjStruct *object = AS_STRUCT(peek(0));
+        if (index < object->fieldCount &&
+            object->type->fieldNames[index] == name) {
+          vm.stackTop[-1] = object->fields[index];
+          break;
+        }
+      }
+      frame->ip = ip;
+      if (!getProperty(name)) {
+        return INTERPRET_RUNTIME_ERROR;
+      }
+      break;
+    }
+    case OP_SET_FIELD: {
+      // Stack before: [receiver, value] and after: [value, receiver], for
+      // the compiler to store the receiver back where it was read from.
+      ObjString *name = READ_STRING();
+      uint8_t index = READ_BYTE();
+      frame->ip = ip;
+      if (!storeField(&vm.stackTop[-2], name, index)) {
+        return INTERPRET_RUNTIME_ERROR;
+      }
+      Value receiver = vm.stackTop[-2];
+      vm.stackTop[-2] = vm.stackTop[-1];
+      vm.stackTop[-1] = receiver;
+      break;
+    }
+    case OP_UPDATE_FIELD: {
+      // Stack before: [receiver, value, field] and after: [value, receiver].
+      // Only a struct field needs storing back; anything else read from the
+      // receiver was changed in place.
+      ObjString *name = READ_STRING();
+      uint8_t index = READ_BYTE();
+      if (IS_STRUCT(peek(0))) {
+        frame->ip = ip;
+        if (!storeField(&vm.stackTop[-3], name, index)) {
+          return INTERPRET_RUNTIME_ERROR;
+        }
+      }
+      Value receiver = vm.stackTop[-3];
+      vm.stackTop[-3] = vm.stackTop[-2];
+      vm.stackTop[-2] = receiver;
+      vm.stackTop--;
+      break;
+    }
+    case OP_GET_SUPER: {
+      ObjString *name = READ_STRING();
+      ObjClass *superclass = AS_CLASS(pop());
+      frame->ip = ip;
+      if (!bindMethod(superclass, name)) {
         return INTERPRET_RUNTIME_ERROR;
       }
-      ObjInstance *instance = AS_INSTANCE(peek(1));
-      tableSet(&instance->fields, READ_STRING(), peek(0));
-      Value value = pop();
-      pop();
-      push(value);
       break;
     }
     case OP_EQUAL: {
@@ -521,6 +2028,33 @@ static InterpretResult run() {
     case OP_LESS:
       BINARY_OP(BOOL_VAL, <);
       break;
+    case OP_IN: {
+      Value container = peek(0);
+      Value item = peek(1);
+      bool found;
+      if (IS_LIST(container)) {
+        found = listContains(AS_LIST(container), item);
+      } else if (IS_TUPLE(container)) {
+        found = tupleContains(AS_TUPLE(container), item);
+      } else if (IS_STRING(container) && IS_STRING(item)) {
+        found = stringContains(AS_STRING(container), AS_STRING(item));
+      } else if (IS_VECTOR(container)) {
+        found = vectorContains(AS_VECTOR(container), item);
+      } else if (IS_MAP(container)) {
+        Value value;
+        found = mapGet(AS_MAP(container), item, &value);
+      } else {
+        frame->ip = ip;
+        runtimeError(IS_STRING(container)
+                         ? "Only a string can be in a string."
+                         : "Right operand of 'in' must be a list, tuple, "
+                           "string, vector or map.");
+        return INTERPRET_RUNTIME_ERROR;
+      }
+      vm.stackTop[-2] = BOOL_VAL(found);
+      vm.stackTop--;
+      break;
+    }
     case OP_ADD: {
       if (IS_STRING(peek(0)) && IS_STRING(peek(1))) {
         concatenate();
@@ -528,9 +2062,13 @@ static InterpretResult run() {
         vm.stackTop[-2] =
             NUMBER_VAL(AS_NUMBER(vm.stackTop[-2]) + AS_NUMBER(vm.stackTop[-1]));
         vm.stackTop--;
+      } else if (IS_LIST(peek(0)) && IS_LIST(peek(1))) {
+        vm.stackTop[-2] = OBJ_VAL(
+            concatenateLists(AS_LIST(vm.stackTop[-2]), AS_LIST(vm.stackTop[-1])));
+        vm.stackTop--;
       } else {
         frame->ip = ip;
-        runtimeError("Operands must be two numbers or two strings");
+        runtimeError("Operands must be two numbers, strings or lists.");
         return INTERPRET_RUNTIME_ERROR;
       }
       break;
@@ -539,7 +2077,15 @@ static InterpretResult run() {
       BINARY_OP_IN_PLACE(-);
       break;
     case OP_MULTIPLY:
-      BINARY_OP_IN_PLACE(*);
+      if (IS_NUMBER(peek(0)) && IS_NUMBER(peek(1))) {
+        vm.stackTop[-2] =
+            NUMBER_VAL(AS_NUMBER(vm.stackTop[-2]) * AS_NUMBER(vm.stackTop[-1]));
+        vm.stackTop--;
+      } else {
+        frame->ip = ip;
+        if (!repeat())
+          return INTERPRET_RUNTIME_ERROR;
+      }
       break;
     case OP_DIVIDE:
       BINARY_OP_IN_PLACE(/);
@@ -556,6 +2102,37 @@ static InterpretResult run() {
       vm.stackTop[-1] = NUMBER_VAL(-AS_NUMBER(vm.stackTop[-1]));
       // push(NUMBER_VAL(-AS_NUMBER(pop())));
       break;
+    case OP_ADD_NUM:
+      UNCHECKED_BINARY_OP(NUMBER_VAL, +);
+      break;
+    case OP_SUBTRACT_NUM:
+      UNCHECKED_BINARY_OP(NUMBER_VAL, -);
+      break;
+    case OP_MULTIPLY_NUM:
+      UNCHECKED_BINARY_OP(NUMBER_VAL, *);
+      break;
+    case OP_DIVIDE_NUM:
+      UNCHECKED_BINARY_OP(NUMBER_VAL, /);
+      break;
+    case OP_GREATER_NUM:
+      UNCHECKED_BINARY_OP(BOOL_VAL, >);
+      break;
+    case OP_LESS_NUM:
+      UNCHECKED_BINARY_OP(BOOL_VAL, <);
+      break;
+    case OP_NEGATE_NUM:
+      VERIFY_NUMBERS(1);
+      vm.stackTop[-1] = NUMBER_VAL(-AS_NUMBER(vm.stackTop[-1]));
+      break;
+    case OP_CHECK_TYPE: {
+      StaticType type = (StaticType)READ_BYTE();
+      if (!hasStaticType(peek(0), type)) {
+        frame->ip = ip;
+        runtimeError("Expected a value of type '%s'.", staticTypeName(type));
+        return INTERPRET_RUNTIME_ERROR;
+      }
+      break;
+    }
     case OP_PRINT: {
       printValue(pop());
       printf("\n");
@@ -574,11 +2151,13 @@ static InterpretResult run() {
     }
     case OP_LOOP: {
       uint16_t offset = READ_SHORT();
+      CONSUME_FUEL();
       ip -= offset;
       break;
     }
     case OP_CALL: {
       int argCount = READ_BYTE();
+      CONSUME_FUEL();
       frame->ip = ip;
       if (!callValue(peek(argCount), argCount)) {
         return INTERPRET_RUNTIME_ERROR;
@@ -590,10 +2169,26 @@ static InterpretResult run() {
     case OP_INVOKE: {
       ObjString *method = READ_STRING();
       int argCount = READ_BYTE();
+      CONSUME_FUEL();
+      frame->ip = ip;
       if (!invoke(method, argCount)) {
         return INTERPRET_RUNTIME_ERROR;
       }
       frame = &vm.frames[vm.frameCount - 1];
+      ip = frame->ip;
+      break;
+    }
+    case OP_SUPER_INVOKE: {
+      ObjString *method = READ_STRING();
+      int argCount = READ_BYTE();
+      CONSUME_FUEL();
+      ObjClass *superclass = AS_CLASS(pop());
+      frame->ip = ip;
+      if (!invokeFromClass(superclass, method, argCount)) {
+        return INTERPRET_RUNTIME_ERROR;
+      }
+      frame = &vm.frames[vm.frameCount - 1];
+      ip = frame->ip;
       break;
     }
     case OP_CLOSURE: {
@@ -631,12 +2226,77 @@ static InterpretResult run() {
       push(OBJ_VAL(list));
       break;
     }
+    case OP_BUILD_TUPLE: {
+      // Stack before: [item1, item2, ..., itemN] and after: [tuple]
+      uint8_t itemCount = READ_BYTE();
+      ObjTuple *tuple = newTuple(vm.stackTop - itemCount, itemCount);
+      vm.stackTop -= itemCount;
+      push(OBJ_VAL(tuple));
+      break;
+    }
     case OP_INDEX_SUBSCR: {
       // Stack before: [list, index] and after: [index(list, index)]
+      frame->ip = ip;
+      if (IS_STRING(peek(1))) {
+        // The string stays on the stack while its character is copied out.
+        ObjString *string = AS_STRING(peek(1));
+        if (!IS_NUMBER(peek(0))) {
+          runtimeError("String index is not a number.");
+          return INTERPRET_RUNTIME_ERROR;
+        }
+        int index = AS_NUMBER(peek(0));
+        if (index < 0 || index >= string->charCount) {
+          runtimeError("String index out of range.");
+          return INTERPRET_RUNTIME_ERROR;
+        }
+        Value character = OBJ_VAL(stringCharAt(string, index));
+        vm.stackTop -= 2;
+        push(character);
+        break;
+      }
       Value oldIndex = pop();
       Value oldList = pop();
       Value result;
 
+      if (IS_TUPLE(oldList)) {
+        ObjTuple *tuple = AS_TUPLE(oldList);
+        if (!IS_NUMBER(oldIndex)) {
+          runtimeError("Tuple index is not a number.");
+          return INTERPRET_RUNTIME_ERROR;
+        }
+        int index = AS_NUMBER(oldIndex);
+        if (index < 0 || index >= tuple->count) {
+          runtimeError("Tuple index out of range.");
+          return INTERPRET_RUNTIME_ERROR;
+        }
+        push(tuple->items[index]);
+        break;
+      }
+
+      if (IS_VECTOR(oldList)) {
+        ObjVector *vector = AS_VECTOR(oldList);
+        if (!IS_NUMBER(oldIndex)) {
+          runtimeError("Vector index is not a number.");
+          return INTERPRET_RUNTIME_ERROR;
+        }
+        int index = AS_NUMBER(oldIndex);
+        if (index < 0 || index >= vector->count) {
+          runtimeError("Vector index out of range.");
+          return INTERPRET_RUNTIME_ERROR;
+        }
+        push(vectorGet(vector, index));
+        break;
+      }
+
+      if (IS_MAP(oldList)) {
+        if (!mapGet(AS_MAP(oldList), oldIndex, &result)) {
+          runtimeError("Key not found.");
+          return INTERPRET_RUNTIME_ERROR;
+        }
+        push(result);
+        break;
+      }
+
       if (!IS_LIST(oldList)) {
         runtimeError("Invalid type to index into.");
         return INTERPRET_RUNTIME_ERROR;
@@ -660,12 +2320,16 @@ static InterpretResult run() {
     }
     case OP_STORE_SUBSCR: {
       // Stack before: [list, index, item] and after: [item]
-      Value item = pop();
-      Value oldIndex = pop();
-      Value oldList = pop();
+      frame->ip = ip;
+      Value item = peek(0);
+      Value oldIndex = peek(1);
+      Value oldList = peek(2);
 
       if (!IS_LIST(oldList)) {
-        runtimeError("Cannot store value in a non-list.");
+        runtimeError(IS_TUPLE(oldList) ? "Tuples are immutable."
+                     : IS_VECTOR(oldList) || IS_MAP(oldList)
+                         ? "Vectors and maps are persistent; use set()."
+                         : "Cannot store value in a non-list.");
         return INTERPRET_RUNTIME_ERROR;
       }
       ObjList *list = AS_LIST(oldList);
@@ -681,32 +2345,144 @@ static InterpretResult run() {
         return INTERPRET_RUNTIME_ERROR;
       }
 
+      // Storing may widen the list, so everything stays on the stack until
+      // it's done.
       storeToList(list, index, item);
+      vm.stackTop -= 3;
+      push(item);
+      break;
+    }
+    case OP_INDEX_LIST: {
+      // Stack before: [list, index] and after: [index(list, index)]
+      // The enclosing loop's guard and condition proved the index in range.
+      VERIFY_LIST_INDEX(0);
+      ObjList *list = AS_LIST(peek(1));
+      Value item = indexFromList(list, (int)AS_NUMBER(peek(0)));
+      vm.stackTop -= 2;
+      push(item);
+      break;
+    }
+    case OP_STORE_LIST: {
+      // Stack before: [list, index, item] and after: [item]
+      frame->ip = ip;
+      VERIFY_LIST_INDEX(1);
+      Value item = peek(0);
+      storeToList(AS_LIST(peek(2)), (int)AS_NUMBER(peek(1)), item);
+      vm.stackTop -= 3;
       push(item);
       break;
     }
+    case OP_GUARD_LIST: {
+      uint16_t length = READ_SHORT();
+      if (!IS_LIST(pop())) {
+        Chunk *chunk = &frame->closure->function->chunk;
+        int end = (int)(ip - chunk->code) + length;
+        deoptimizeLoop(chunk, (int)(ip - chunk->code) - 5, end);
+      }
+      break;
+    }
     case OP_CLOSE_UPVALUE:
       closeUpvalues(vm.stackTop - 1);
       pop();
       break;
     case OP_RETURN: {
-      Value result = pop();
+      // Stack before: [callee, args..., locals..., results...]
+      // and after: [results...], trimmed to as many as the caller wants.
+      uint8_t returnCount = READ_BYTE();
+      Value *results = vm.stackTop - returnCount;
+      int resultCount = 1;
+
+      if (vm.frameCount > vm.baseFrame + 1) {
+        // A caller that unpacks several results follows the call with
+        // OP_UNPACK, which is consumed here rather than executed.
+        CallFrame *caller = &vm.frames[vm.frameCount - 2];
+        if (*caller->ip == OP_UNPACK) {
+          resultCount = caller->ip[1];
+          if (returnCount != resultCount) {
+            frame->ip = ip;
+            runtimeError("Expected %d return values but got %d.", resultCount,
+                         returnCount);
+            return INTERPRET_RUNTIME_ERROR;
+          }
+          caller->ip += 2;
+        }
+      }
+
       closeUpvalues(frame->slots);
       vm.frameCount--;
       if (vm.frameCount == 0) {
-        pop();
+        vm.stackTop = frame->slots;
         return INTERPRET_OK;
       }
 
-      vm.stackTop = frame->slots;
-      push(result);
+      for (int i = 0; i < resultCount; i++) {
+        frame->slots[i] = results[i];
+      }
+      vm.stackTop = frame->slots + resultCount;
+      if (vm.frameCount == vm.baseFrame)
+        return INTERPRET_OK;
+      frame = &vm.frames[vm.frameCount - 1];
+      ip = frame->ip;
+      break;
+    }
+    case OP_BREAK:
+      // A debugger trap patched over the real instruction, which is handed
+      // back and dispatched as if it had been read here.
+      frame->ip = ip;
+      instruction = debuggerTrap();
+      goto dispatch;
+    case OP_THROW: {
+      frame->ip = ip;
+      Value exception = peek(0);
+      if (!catchException(exception)) {
+        char message[256];
+        snprintf(message, sizeof(message), "Uncaught exception: %s",
+                 IS_STRING(exception) ? AS_CSTRING(exception) : "non-string value");
+        reportError(message);
+        return INTERPRET_RUNTIME_ERROR;
+      }
+      if (vm.frameCount == vm.baseFrame)
+        return INTERPRET_RUNTIME_ERROR;
       frame = &vm.frames[vm.frameCount - 1];
       ip = frame->ip;
       break;
     }
+    case OP_UNPACK: {
+      // Only reached when the value didn't come from a returning function,
+      // which always produces exactly one value.
+      uint8_t count = READ_BYTE();
+      frame->ip = ip;
+      runtimeError("Expected %d return values but got 1.", count);
+      return INTERPRET_RUNTIME_ERROR;
+    }
     case OP_CLASS:
       push(OBJ_VAL(newClass(READ_STRING())));
       break;
+    case OP_STRUCT: {
+      ObjString *name = READ_STRING();
+      uint8_t fieldCount = READ_BYTE();
+      ObjStructType *type = newStructType(name, fieldCount);
+      for (int i = 0; i < fieldCount; i++) {
+        type->fieldNames[i] = READ_STRING();
+      }
+      push(OBJ_VAL(type));
+      break;
+    }
+    case OP_INHERIT: {
+      Value superclass = peek(1);
+      if (!IS_CLASS(superclass)) {
+        frame->ip = ip;
+        runtimeError("Superclass must be a class.");
+        return INTERPRET_RUNTIME_ERROR;
+      }
+      // Copy the superclass methods down so lookups stay a single probe.
+      ObjClass *subclass = AS_CLASS(peek(0));
+      tableAddAll(&AS_CLASS(superclass)->methods, &subclass->methods);
+      subclass->initializer = AS_CLASS(superclass)->initializer;
+      subclass->fieldCount = AS_CLASS(superclass)->fieldCount;
+      pop(); // Subclass.
+      break;
+    }
     case OP_METHOD:
       defineMethod(READ_STRING());
       break;
@@ -716,20 +2492,42 @@ static InterpretResult run() {
 #undef READ_CONSTANT
 #undef READ_SHORT
 #undef READ_STRING
+#undef COMPOUND_ASSIGN
+#undef CONSUME_FUEL
+#undef UNCHECKED_BINARY_OP
+#undef VERIFY_NUMBERS
 #undef BINARY_OP_IN_PLACE
 #undef BINARY_OP
 }
 
 InterpretResult interpret(const char *source) {
+  // The compiled code is immortal only while it runs. Afterwards anything
+  // still using it, like a function a REPL line stored in a global, keeps
+  // it alive through ordinary tracing.
+  Obj *immortals = vm.immortalObjects;
+  vm.allocatingImmortal = true;
   ObjFunction *function = compile(source);
-  if (function == NULL)
+  vm.allocatingImmortal = false;
+  if (function == NULL) {
+    releaseImmortalObjects(immortals);
     return INTERPRET_COMPILE_ERROR;
+  }
 
   push(OBJ_VAL(function));
   ObjClosure *closure = newClosure(function);
   pop();
   push(OBJ_VAL(closure));
   call(closure, 0);
+  if (debuggerEnabled()) {
+    debuggerAttach(function);
+  }
 
-  return run();
+  // An error caught by a try block leaves the VM at the handler, with frames
+  // still active; an uncaught one resets the stack.
+  InterpretResult result;
+  do {
+    result = run();
+  } while (result == INTERPRET_RUNTIME_ERROR && vm.frameCount > 0);
+  releaseImmortalObjects(immortals);
+  return result;
 }
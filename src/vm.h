@@ -1,13 +1,16 @@
 #ifndef clang_vm_h
 #define clang_vm_h
 
+#include "allocator.h"
 #include "chunk.h"
 #include "object.h"
+#include <stdatomic.h>
 #include "table.h"
 #include "value.h"
 
 #define FRAMES_MAX 64
 #define STACK_MAX 256
+#define BOUND_METHOD_CACHE_SIZE 256
 
 typedef struct {
   ObjClosure *closure;
@@ -18,16 +21,55 @@ typedef struct {
 typedef struct {
   CallFrame frames[FRAMES_MAX];
   int frameCount;
+  // Frames below this belong to code that called a native which is now
+  // calling back into the script; run() returns when it gets back here.
+  int baseFrame;
   Value stack[STACK_MAX];
   Value *stackTop;
   Table globals;
+  // Top-level `const` names from every successful compile, so later REPL
+  // lines still can't reassign them.
+  Table constGlobals;
+  // Declared types of top-level `let` names, for the same reason.
+  Table globalTypes;
   Table strings;
+  Table listMethods;
+  Table stringMethods;
+  Table tupleMethods;
+  Table iteratorMethods;
+  Table priorityQueueMethods;
+  Table vectorMethods;
+  Table mapMethods;
   ObjString *initString;
   ObjUpvalue *openUpvalues;
+  // Recently bound methods, keyed by (receiver, method). Cleared on every GC.
+  ObjBoundMethod *boundMethods[BOUND_METHOD_CACHE_SIZE];
+  // Loop back-edges and calls left before the script is stopped; negative
+  // means unlimited. interrupted may be set from another thread or a signal.
+  int64_t fuel;
+  atomic_bool interrupted;
 
+  Allocator allocator;
   size_t bytesAllocated;
   size_t nextGC;
+  // Bytes requested since the last collection, ignoring frees.
+  size_t bytesSinceGC;
+  // Nesting depth of pauseGC() calls from scripts.
+  int gcPauseDepth;
   Obj *objects;
+  // Objects made by initVM, and by the compiler for code that is running.
+  // Everything they reference is immortal too, so the collector neither
+  // traces nor sweeps them.
+  Obj *immortalObjects;
+  bool allocatingImmortal;
+  // Runtime objects made immortal in place while compiling, which stay on
+  // the objects list until releaseImmortalObjects() reverts them.
+  int promotedCount;
+  int promotedCapacity;
+  Obj **promoted;
+  // Blocks mapped directly from the OS; see LARGE_OBJECT_THRESHOLD.
+  struct LargeBlock *largeBlocks;
+  size_t largeBytes;
   int grayCount;
   int grayCapacity;
   Obj **grayStack;
@@ -42,8 +84,12 @@ typedef enum {
 extern VM vm;
 
 void initVM();
+void initVMWithAllocator(Allocator allocator);
 void freeVM();
 InterpretResult interpret(const char *source);
+void setFuel(int64_t fuel);
+void interruptVM();
+void clearInterrupt();
 void push(Value value);
 Value pop();
 